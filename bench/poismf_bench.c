@@ -0,0 +1,320 @@
+ /*
+    Poisson Factorization for sparse matrices
+
+    Based on alternating proximal gradient iteration or conjugate gradient.
+    Variables must be initialized from outside the main function ('run_poismf').
+    Writen for C99 standard and OpenMP 2.0 or later.
+
+    Reference paper is:
+        Cortes, David.
+        "Fast Non-Bayesian Poisson Factorization for Implicit-Feedback Recommendations."
+        arXiv preprint arXiv:1811.01908 (2018).
+
+    BSD 2-Clause License
+
+    Copyright (c) 2020, David Cortes
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*  Microbenchmarks for the solver kernels and the serving paths.
+
+    Generates synthetic power-law data (skewed item popularity and row
+    sizes, like real interaction logs) and times one full pass of each
+    solver iteration plus the hot serving entry points, across sweeps of
+    factor width, density and thread count. Throughput is reported as
+    rows (or calls) per second together with estimated GFLOP/s and GB/s,
+    so builds, compilers and BLAS backends can be compared before
+    deploying.
+
+    Build with the Makefile next to this file:  make && ./poismf_bench
+    Optional arguments:  ./poismf_bench [dimA] [dimB]                   */
+#include "poismf.h"
+
+#ifdef _OPENMP
+    #include <omp.h>
+#else
+    static double omp_get_wtime_fallback(void) { return (double)clock() / (double)CLOCKS_PER_SEC; }
+    #define omp_get_wtime omp_get_wtime_fallback
+    #define omp_get_max_threads() (1)
+#endif
+#include <time.h>
+
+/* xorshift64* - deterministic across platforms, no libc rng state */
+static uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+static uint64_t rng_next(void)
+{
+    uint64_t x = rng_state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    rng_state = x;
+    return x * 0x2545F4914F6CDD1Dull;
+}
+static double rng_unif(void) { return (double)(rng_next() >> 11) / 9007199254740992.; }
+
+/*  Power-law synthetic CSR: row sizes and item picks both follow
+    u^alpha-style skew, so a few rows and items are very heavy - the
+    shape that stresses the dynamic scheduling and the heavy-row paths */
+typedef struct bench_data {
+    size_t dimA, dimB, nnz;
+    real_t *Xr, *Xc;
+    sparse_ix *Xr_indptr, *Xr_indices;
+    sparse_ix *Xc_indptr, *Xc_indices, *csc_map;
+} bench_data;
+
+static int bench_gen(bench_data *d, size_t dimA, size_t dimB, size_t mean_nnz)
+{
+    memset(d, 0, sizeof(*d));
+    d->dimA = dimA;
+    d->dimB = dimB;
+    d->Xr_indptr = (sparse_ix*)malloc((dimA+1)*sizeof(sparse_ix));
+    if (d->Xr_indptr == NULL) return 1;
+    d->Xr_indptr[0] = 0;
+    for (size_t row = 0; row < dimA; row++) {
+        /* mean preserved, max ~8x the mean */
+        size_t nnz_row = 1 + (size_t)((double)(2*mean_nnz - 2)
+                                       * pow(rng_unif(), 3.) * 4. / 4.);
+        nnz_row = (nnz_row > dimB)? dimB : nnz_row;
+        d->Xr_indptr[row+1] = d->Xr_indptr[row] + (sparse_ix)nnz_row;
+    }
+    d->nnz = (size_t)d->Xr_indptr[dimA];
+    d->Xr = (real_t*)malloc(d->nnz*sizeof(real_t));
+    d->Xr_indices = (sparse_ix*)malloc(d->nnz*sizeof(sparse_ix));
+    d->Xc_indptr = (sparse_ix*)malloc((dimB+1)*sizeof(sparse_ix));
+    d->Xc_indices = (sparse_ix*)malloc(d->nnz*sizeof(sparse_ix));
+    d->csc_map = (sparse_ix*)malloc(d->nnz*sizeof(sparse_ix));
+    d->Xc = (real_t*)malloc(d->nnz*sizeof(real_t));
+    if (d->Xr == NULL || d->Xr_indices == NULL || d->Xc_indptr == NULL ||
+        d->Xc_indices == NULL || d->csc_map == NULL || d->Xc == NULL)
+        return 1;
+    for (size_t ix = 0; ix < d->nnz; ix++) {
+        d->Xr[ix] = (real_t)(1. + 4.*rng_unif());
+        /* popularity skew: low ids get picked much more often */
+        d->Xr_indices[ix] = (sparse_ix)((double)dimB * pow(rng_unif(), 2.5));
+    }
+    if (poismf_build_csc_map(d->Xr_indptr, d->Xr_indices, dimA, dimB,
+                             d->Xc_indptr, d->Xc_indices, d->csc_map))
+        return 1;
+    for (size_t ix = 0; ix < d->nnz; ix++)
+        d->Xc[ix] = d->Xr[d->csc_map[ix]];
+    return 0;
+}
+
+static void bench_free(bench_data *d)
+{
+    free(d->Xr); free(d->Xr_indptr); free(d->Xr_indices);
+    free(d->Xc); free(d->Xc_indptr); free(d->Xc_indices);
+    free(d->csc_map);
+    memset(d, 0, sizeof(*d));
+}
+
+static void fill_factors(real_t *M, size_t n)
+{
+    for (size_t ix = 0; ix < n; ix++)
+        M[ix] = (real_t)(0.1 + 0.8*rng_unif());
+}
+
+/* One full alternating iteration of the given solver, timed through
+   'run_poismf_ext' so the setup matches training exactly; FLOPs come
+   from the telemetry */
+static void bench_solver(bench_data *d, size_t k, int nthreads, Method method,
+                         const char *name)
+{
+    real_t *A = (real_t*)malloc(d->dimA*k*sizeof(real_t));
+    real_t *B = (real_t*)malloc(d->dimB*k*sizeof(real_t));
+    if (A == NULL || B == NULL) { free(A); free(B); return; }
+    fill_factors(A, d->dimA*k);
+    fill_factors(B, d->dimB*k);
+
+    poismf_stats stats;
+    poismf_opts opts;
+    poismf_opts_init(&opts);
+    poismf_stats_init(&stats);
+    opts.stats = &stats;
+
+    double t0 = omp_get_wtime();
+    run_poismf_ext(A, d->Xr, d->Xr_indptr, d->Xr_indices,
+                   B, d->Xc, d->Xc_indptr, d->Xc_indices,
+                   d->dimA, d->dimB, k,
+                   1e-9, 0., 1., 1e-7,
+                   method, 1, 1, 15, 0, nthreads, &opts);
+    double el = omp_get_wtime() - t0;
+    double rows = (double)(d->dimA + d->dimB);
+    printf("k=%-4zu nnz/row=%-4zu threads=%-3d %-18s %10.0f rows/s  %7.2f GF/s  %7.2f GB/s\n",
+           k, d->nnz / d->dimA, nthreads, name,
+           rows / el, stats.flops_est / el / 1e9,
+           2. * stats.flops_est / el / 1e9);
+    free(A); free(B);
+}
+
+/* Repeated objective+gradient evaluations over a spread of rows - the
+   innermost cost of the tncg solver, without the solver around it */
+static void bench_fun_grad(bench_data *d, size_t k, const char *name)
+{
+    real_t *A = (real_t*)malloc(d->dimA*k*sizeof(real_t));
+    real_t *B = (real_t*)malloc(d->dimB*k*sizeof(real_t));
+    real_t *Bsum = (real_t*)malloc(k*sizeof(real_t));
+    real_t *grad = (real_t*)malloc(k*sizeof(real_t));
+    if (A == NULL || B == NULL || Bsum == NULL || grad == NULL)
+        { free(A); free(B); free(Bsum); free(grad); return; }
+    fill_factors(A, d->dimA*k);
+    fill_factors(B, d->dimB*k);
+    sum_by_cols(Bsum, B, d->dimB, k);
+
+    size_t n_evals = 0, nnz_seen = 0;
+    real_t f;
+    fdata data = { B, Bsum, NULL, NULL, NULL, 0, (real_t)1e-9, 1., (int)k };
+    double t0 = omp_get_wtime();
+    double el;
+    for (;;) {
+        for (size_t row = 0; row < d->dimA; row += 97) {
+            data.Xr = d->Xr + d->Xr_indptr[row];
+            data.X_ind = d->Xr_indices + d->Xr_indptr[row];
+            data.nnz_this = d->Xr_indptr[row+1] - d->Xr_indptr[row];
+            if (data.nnz_this == 0) continue;
+            calc_fun_and_grad(A + row*k, &f, grad, &data);
+            n_evals++;
+            nnz_seen += (size_t)data.nnz_this;
+        }
+        el = omp_get_wtime() - t0;
+        if (el > 0.5) break;
+    }
+    double flops = 4. * (double)k * (double)nnz_seen;
+    printf("k=%-4zu nnz/row=%-4zu threads=%-3d %-18s %10.0f evals/s %7.2f GF/s  %7.2f GB/s\n",
+           k, d->nnz / d->dimA, 1, name,
+           (double)n_evals / el, flops / el / 1e9, 2. * flops / el / 1e9);
+    free(A); free(B); free(Bsum); free(grad);
+}
+
+static void bench_serving(bench_data *d, size_t k, int nthreads)
+{
+    size_t n_top = 10;
+    size_t n_pairs = 1000000;
+    real_t *A = (real_t*)malloc(d->dimA*k*sizeof(real_t));
+    real_t *B = (real_t*)malloc(d->dimB*k*sizeof(real_t));
+    real_t *Bsum = (real_t*)malloc(k*sizeof(real_t));
+    sparse_ix *out_ix = (sparse_ix*)malloc(n_top*sizeof(sparse_ix));
+    real_t *out_sc = (real_t*)malloc(n_top*sizeof(real_t));
+    sparse_ix *pair_a = (sparse_ix*)malloc(n_pairs*sizeof(sparse_ix));
+    sparse_ix *pair_b = (sparse_ix*)malloc(n_pairs*sizeof(sparse_ix));
+    real_t *pair_out = (real_t*)malloc(n_pairs*sizeof(real_t));
+    real_t *fct = (real_t*)malloc(k*sizeof(real_t));
+    if (A == NULL || B == NULL || Bsum == NULL || out_ix == NULL ||
+        out_sc == NULL || pair_a == NULL || pair_b == NULL ||
+        pair_out == NULL || fct == NULL)
+        goto cleanup;
+    fill_factors(A, d->dimA*k);
+    fill_factors(B, d->dimB*k);
+    sum_by_cols(Bsum, B, d->dimB, k);
+    for (size_t ix = 0; ix < n_pairs; ix++) {
+        pair_a[ix] = (sparse_ix)(rng_next() % d->dimA);
+        pair_b[ix] = (sparse_ix)(rng_next() % d->dimB);
+    }
+
+    size_t n_calls = 0;
+    double t0, el;
+
+    t0 = omp_get_wtime();
+    for (;;) {
+        topN(A + (n_calls % d->dimA)*k, B, (int)k, NULL, 0, NULL, 0,
+             out_ix, out_sc, n_top, d->dimB, nthreads);
+        n_calls++;
+        el = omp_get_wtime() - t0;
+        if (el > 0.5) break;
+    }
+    double bytes = (double)n_calls * (double)d->dimB * (double)k * sizeof(real_t);
+    printf("k=%-4zu nnz/row=%-4zu threads=%-3d %-18s %10.0f calls/s %7s      %7.2f GB/s\n",
+           k, d->nnz / d->dimA, nthreads, "topN",
+           (double)n_calls / el, "", bytes / el / 1e9);
+
+    t0 = omp_get_wtime();
+    predict_multiple(pair_out, A, B, pair_a, pair_b, n_pairs, (int)k, nthreads);
+    el = omp_get_wtime() - t0;
+    bytes = (double)n_pairs * 2. * (double)k * sizeof(real_t);
+    printf("k=%-4zu nnz/row=%-4zu threads=%-3d %-18s %10.0f pairs/s %7.2f GF/s  %7.2f GB/s\n",
+           k, d->nnz / d->dimA, nthreads, "predict_multiple",
+           (double)n_pairs / el,
+           2. * (double)n_pairs * (double)k / el / 1e9, bytes / el / 1e9);
+
+    n_calls = 0;
+    t0 = omp_get_wtime();
+    for (;;) {
+        size_t row = n_calls % d->dimA;
+        size_t nnz_this = d->Xr_indptr[row+1] - d->Xr_indptr[row];
+        if (nnz_this != 0)
+            factors_single(fct, k, A, d->dimA,
+                           d->Xr + d->Xr_indptr[row],
+                           d->Xr_indices + d->Xr_indptr[row], nnz_this,
+                           B, Bsum, 15, 1e-9, 0., 0., 1.);
+        n_calls++;
+        el = omp_get_wtime() - t0;
+        if (el > 0.5) break;
+    }
+    printf("k=%-4zu nnz/row=%-4zu threads=%-3d %-18s %10.0f calls/s\n",
+           k, d->nnz / d->dimA, nthreads, "factors_single",
+           (double)n_calls / el);
+
+    cleanup:
+        free(A); free(B); free(Bsum); free(out_ix); free(out_sc);
+        free(pair_a); free(pair_b); free(pair_out); free(fct);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t dimA = (argc > 1)? (size_t)atoll(argv[1]) : (size_t)100000;
+    size_t dimB = (argc > 2)? (size_t)atoll(argv[2]) : (size_t)20000;
+    size_t ks[] = {32, 64, 128};
+    size_t densities[] = {20, 100};
+    int thread_counts[2] = {1, 0};
+    thread_counts[1] = omp_get_max_threads();
+    int n_threads_sweep = (thread_counts[1] > 1)? 2 : 1;
+
+    printf("poismf bench: dimA=%zu dimB=%zu real_t=%zu bytes\n\n",
+           dimA, dimB, sizeof(real_t));
+
+    for (size_t id = 0; id < sizeof(densities)/sizeof(densities[0]); id++)
+    {
+        bench_data d;
+        rng_state = 0x9E3779B97F4A7C15ull; /* same data for every build */
+        if (bench_gen(&d, dimA, dimB, densities[id])) {
+            fprintf(stderr, "Error: out of memory.\n");
+            return 1;
+        }
+        for (size_t ik = 0; ik < sizeof(ks)/sizeof(ks[0]); ik++)
+        {
+            for (int it = 0; it < n_threads_sweep; it++)
+            {
+                int nthreads = thread_counts[it];
+                bench_solver(&d, ks[ik], nthreads, pg,   "pg_iteration");
+                bench_solver(&d, ks[ik], nthreads, cg,   "cg_iteration");
+                bench_solver(&d, ks[ik], nthreads, tncg, "tncg_iteration");
+                bench_serving(&d, ks[ik], nthreads);
+            }
+            bench_fun_grad(&d, ks[ik], "calc_fun_and_grad");
+            printf("\n");
+        }
+        bench_free(&d);
+    }
+    return 0;
+}
@@ -70,13 +70,15 @@ if not from_rtd:
             Extension("poismf.c_funs_double",
                 sources=["poismf/cfuns_double.pyx",
                          "src/poismf.c", "src/topN.c", "src/pred.c",
-                         "src/nonnegcg.c", "src/tnc.c"],
+                         "src/nonnegcg.c", "src/tnc.c",
+                         "src/simd_kernels.c", "src/serialize.c", "src/ooc.c", "src/mips.c", "src/poismf_f32.c", "src/poismf_ix32.c", "src/dtype.c"],
                 include_dirs=[numpy.get_include(), "src/"],
                 define_macros = [("_FOR_PYTHON", None)]),
             Extension("poismf.c_funs_float",
                 sources=["poismf/cfuns_float.pyx",
                          "src/poismf.c", "src/topN.c", "src/pred.c",
-                         "src/nonnegcg.c", "src/tnc.c"],
+                         "src/nonnegcg.c", "src/tnc.c",
+                         "src/simd_kernels.c", "src/serialize.c", "src/ooc.c", "src/mips.c", "src/poismf_f32.c", "src/poismf_ix32.c", "src/dtype.c"],
                 include_dirs=[numpy.get_include(), "src/"],
                 define_macros = [("_FOR_PYTHON", None), ("USE_FLOAT", None)])
             ]
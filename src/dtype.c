@@ -0,0 +1,115 @@
+ /*
+    Poisson Factorization for sparse matrices
+
+    Based on alternating proximal gradient iteration or conjugate gradient.
+    Variables must be initialized from outside the main function ('run_poismf').
+    Writen for C99 standard and OpenMP 2.0 or later.
+
+    Reference paper is:
+        Cortes, David.
+        "Fast Non-Bayesian Poisson Factorization for Implicit-Feedback Recommendations."
+        arXiv preprint arXiv:1811.01908 (2018).
+
+    BSD 2-Clause License
+
+    Copyright (c) 2020, David Cortes
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "poismf.h"
+
+/*  Runtime precision dispatchers. The factors and data arrays are passed as
+    'void*' and interpreted as double or float according to 'dtype'; the
+    index arrays and hyperparameters are precision-independent. These only
+    exist in the default double build, where the float32 copy of the library
+    (poismf_f32.c) is linked alongside. */
+#if !defined(USE_FLOAT) && !defined(_FOR_R)
+
+int run_poismf_rt(
+    const poismf_dtype dtype,
+    void *restrict A, void *restrict Xr, sparse_ix *restrict Xr_indptr, sparse_ix *restrict Xr_indices,
+    void *restrict B, void *restrict Xc, sparse_ix *restrict Xc_indptr, sparse_ix *restrict Xc_indices,
+    const size_t dimA, const size_t dimB, const size_t k,
+    const double l2_reg, const double l1_reg, const double w_mult, double step_size,
+    const Method method, const bool limit_step, const size_t numiter, const size_t maxupd,
+    const bool handle_interrupt, const int nthreads)
+{
+    if (dtype == poismf_f32)
+        return run_poismf_f32((float*)A, (float*)Xr, Xr_indptr, Xr_indices,
+                              (float*)B, (float*)Xc, Xc_indptr, Xc_indices,
+                              dimA, dimB, k,
+                              l2_reg, l1_reg, w_mult, step_size,
+                              method, limit_step, numiter, maxupd,
+                              handle_interrupt, nthreads);
+    else
+        return run_poismf((double*)A, (double*)Xr, Xr_indptr, Xr_indices,
+                          (double*)B, (double*)Xc, Xc_indptr, Xc_indices,
+                          dimA, dimB, k,
+                          l2_reg, l1_reg, w_mult, step_size,
+                          method, limit_step, numiter, maxupd,
+                          handle_interrupt, nthreads);
+}
+
+int topN_rt
+(
+    const poismf_dtype dtype,
+    void *restrict a_vec, void *restrict B, int k,
+    sparse_ix *restrict include_ix, size_t n_include,
+    sparse_ix *restrict exclude_ix, size_t n_exclude,
+    sparse_ix *restrict outp_ix, void *restrict outp_score,
+    size_t n_top, size_t n, int nthreads
+)
+{
+    if (dtype == poismf_f32)
+        return topN_f32((float*)a_vec, (float*)B, k,
+                        include_ix, n_include,
+                        exclude_ix, n_exclude,
+                        outp_ix, (float*)outp_score,
+                        n_top, n, nthreads);
+    else
+        return topN((double*)a_vec, (double*)B, k,
+                    include_ix, n_include,
+                    exclude_ix, n_exclude,
+                    outp_ix, (double*)outp_score,
+                    n_top, n, nthreads);
+}
+
+void predict_multiple_rt
+(
+    const poismf_dtype dtype,
+    void *restrict out,
+    void *restrict A, void *restrict B,
+    sparse_ix *ixA, sparse_ix *ixB,
+    size_t n, int k,
+    int nthreads
+)
+{
+    if (dtype == poismf_f32)
+        predict_multiple_f32((float*)out, (float*)A, (float*)B,
+                             ixA, ixB, n, k, nthreads);
+    else
+        predict_multiple((double*)out, (double*)A, (double*)B,
+                         ixA, ixB, n, k, nthreads);
+}
+
+#endif
@@ -0,0 +1,265 @@
+ /*
+    Poisson Factorization for sparse matrices
+
+    Based on alternating proximal gradient iteration or conjugate gradient.
+    Variables must be initialized from outside the main function ('run_poismf').
+    Writen for C99 standard and OpenMP 2.0 or later.
+
+    Reference paper is:
+        Cortes, David.
+        "Fast Non-Bayesian Poisson Factorization for Implicit-Feedback Recommendations."
+        arXiv preprint arXiv:1811.01908 (2018).
+
+    BSD 2-Clause License
+
+    Copyright (c) 2020, David Cortes
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "poismf.h"
+
+/*  Pruned maximum-inner-product search over a trained B matrix.
+
+    Both factor matrices are nonnegative, which gives a cheap and safe upper
+    bound: for any block of items, the score of every item in it is at most
+    the dot product of the query with the elementwise maximum of the block's
+    rows. The index sorts the items by factor norm (so that similarly-large
+    items share blocks and the bounds are tight), groups them into fixed-size
+    blocks, and stores one maximum vector per block.
+
+    A query then costs one small GEMV over the block maxima (n/block_size
+    rows) to get every block's bound, after which blocks are visited from the
+    most promising down, scored exactly with a dense GEMV each, and the scan
+    stops as soon as no remaining block can beat the current top-N floor.
+    With well-clustered norms most blocks are never scored, making the serve
+    cost sublinear in the item count in practice; the bound test is exact,
+    so with 'prune_mult' at 1 the results match the exhaustive 'topN'. */
+
+/* Items per block: large enough that the per-block GEMV runs at full speed,
+   small enough that the bounds stay selective */
+#define POISMF_MIPS_BLOCK ((size_t)256)
+
+/*  Builds the index from a trained B matrix (the rows are copied, so 'B'
+    does not need to outlive it). 'block_size' of zero takes the default.
+    Returns 0 on success, 1 on out-of-memory. */
+int poismf_mips_index_build
+(
+    poismf_mips_index *restrict index,
+    real_t *restrict B, size_t n, size_t k,
+    size_t block_size
+)
+{
+    memset(index, 0, sizeof(*index));
+    if (block_size == 0) block_size = POISMF_MIPS_BLOCK;
+    index->n = n;
+    index->k = k;
+    index->block_size = block_size;
+    index->n_blocks = (n + block_size - 1) / block_size;
+
+    real_t *restrict norms = (real_t*)malloc(n*sizeof(real_t));
+    index->item_order = (sparse_ix*)malloc(n*sizeof(sparse_ix));
+    index->B_sorted = (real_t*)malloc(n*k*sizeof(real_t));
+    index->block_max = (real_t*)calloc(index->n_blocks*k, sizeof(real_t));
+    if (norms == NULL || index->item_order == NULL ||
+        index->B_sorted == NULL || index->block_max == NULL)
+    {
+        fprintf(stderr, "Error: out of memory.\n");
+        free(norms);
+        poismf_mips_index_free(index);
+        return 1;
+    }
+
+    for (size_t row = 0; row < n; row++) {
+        norms[row] = cblas_tnrm2((int)k, B + row*k, 1);
+        index->item_order[row] = (sparse_ix)row;
+    }
+    ptr_real_t_glob = norms;
+    qsort(index->item_order, n, sizeof(sparse_ix), cmp_argsort);
+    ptr_real_t_glob = NULL;
+    free(norms);
+
+    for (size_t row = 0; row < n; row++)
+    {
+        real_t *restrict b_row = B + (size_t)index->item_order[row]*k;
+        real_t *restrict bmax = index->block_max + (row / block_size)*k;
+        memcpy(index->B_sorted + row*k, b_row, k*sizeof(real_t));
+        for (size_t col = 0; col < k; col++)
+            bmax[col] = (b_row[col] > bmax[col])? b_row[col] : bmax[col];
+    }
+    return 0;
+}
+
+void poismf_mips_index_free(poismf_mips_index *restrict index)
+{
+    free(index->item_order);
+    free(index->B_sorted);
+    free(index->block_max);
+    memset(index, 0, sizeof(*index));
+}
+
+/* Insert into the running top-N (linear scan - n_top is small) */
+static void mips_topn_insert
+(
+    sparse_ix *restrict top_ix, real_t *restrict top_sc,
+    size_t *restrict n_found, size_t n_top,
+    sparse_ix ix, real_t sc
+)
+{
+    if (*n_found < n_top) {
+        top_ix[*n_found] = ix;
+        top_sc[*n_found] = sc;
+        (*n_found)++;
+        return;
+    }
+    size_t min_pos = 0;
+    for (size_t pos = 1; pos < n_top; pos++)
+        if (top_sc[pos] < top_sc[min_pos]) min_pos = pos;
+    if (sc > top_sc[min_pos]) {
+        top_ix[min_pos] = ix;
+        top_sc[min_pos] = sc;
+    }
+}
+
+static real_t mips_topn_floor(real_t *restrict top_sc, size_t n_found)
+{
+    real_t floor_sc = top_sc[0];
+    for (size_t pos = 1; pos < n_found; pos++)
+        floor_sc = (top_sc[pos] < floor_sc)? top_sc[pos] : floor_sc;
+    return floor_sc;
+}
+
+/*  Top-N through the index. 'prune_mult' steers the recall/speed trade-off:
+    a block is skipped once its upper bound is at most 'prune_mult' times
+    the current N-th best score, so 1 gives the exact answer (the bound is
+    a true bound) and values above 1 prune harder at some recall cost.
+    'exclude_ix' works like in 'topN' (may be NULL; gets sorted in place).
+    For small item counts the index degenerates to scoring everything, i.e.
+    the exact dense path - there is no penalty beyond the block bookkeeping.
+    Returns 0 on success, 1 on out-of-memory, 2 on invalid inputs. */
+int topN_approx
+(
+    real_t *restrict a_vec,
+    poismf_mips_index *restrict index,
+    sparse_ix *restrict exclude_ix, size_t n_exclude,
+    sparse_ix *restrict outp_ix, real_t *restrict outp_score,
+    size_t n_top, real_t prune_mult
+)
+{
+    size_t n = index->n;
+    size_t k = index->k;
+    size_t n_blocks = index->n_blocks;
+    if (n_top == 0 || prune_mult < 1.) return 2;
+    if (n_exclude > n - n_top) return 2;
+    if (n_exclude == 0) exclude_ix = NULL;
+
+    int retval = 0;
+    real_t *restrict bounds = NULL;
+    sparse_ix *restrict block_order = NULL;
+    real_t *restrict preds = NULL;
+    sparse_ix *restrict top_ix = NULL;
+    real_t *restrict top_sc = NULL;
+    sparse_ix *restrict out_order = NULL;
+    size_t n_found = 0;
+
+    bounds = (real_t*)malloc(n_blocks*sizeof(real_t));
+    block_order = (sparse_ix*)malloc(n_blocks*sizeof(sparse_ix));
+    preds = (real_t*)malloc(index->block_size*sizeof(real_t));
+    top_ix = (sparse_ix*)malloc(n_top*sizeof(sparse_ix));
+    top_sc = (real_t*)malloc(n_top*sizeof(real_t));
+    out_order = (sparse_ix*)malloc(n_top*sizeof(sparse_ix));
+    if (bounds == NULL || block_order == NULL || preds == NULL ||
+        top_ix == NULL || top_sc == NULL || out_order == NULL)
+    {
+        retval = 1;
+        goto cleanup;
+    }
+
+    if (exclude_ix != NULL && !check_is_sorted(exclude_ix, n_exclude))
+        qsort(exclude_ix, n_exclude, sizeof(sparse_ix), cmp_size_t);
+
+    cblas_tgemv(CblasRowMajor, CblasNoTrans,
+                (int)n_blocks, (int)k,
+                1., index->block_max, (int)k,
+                a_vec, 1,
+                0., bounds, 1);
+    for (size_t b = 0; b < n_blocks; b++)
+        block_order[b] = (sparse_ix)b;
+    ptr_real_t_glob = bounds;
+    qsort(block_order, n_blocks, sizeof(sparse_ix), cmp_argsort);
+    ptr_real_t_glob = NULL;
+
+    for (size_t pos = 0; pos < n_blocks; pos++)
+    {
+        size_t b = (size_t)block_order[pos];
+        if (n_found == n_top &&
+            bounds[b] <= prune_mult * mips_topn_floor(top_sc, n_found))
+            break;
+
+        size_t row_st = b * index->block_size;
+        size_t row_end = row_st + index->block_size;
+        row_end = (row_end > n)? n : row_end;
+        int bs = (int)(row_end - row_st);
+
+        cblas_tgemv(CblasRowMajor, CblasNoTrans,
+                    bs, (int)k,
+                    1., index->B_sorted + row_st*k, (int)k,
+                    a_vec, 1,
+                    0., preds, 1);
+
+        for (size_t row = row_st; row < row_end; row++)
+        {
+            sparse_ix item = index->item_order[row];
+            if (exclude_ix != NULL) {
+                sparse_ix *hit = (sparse_ix*)bsearch(&item, exclude_ix,
+                                                     n_exclude,
+                                                     sizeof(sparse_ix),
+                                                     cmp_size_t);
+                if (hit != NULL) continue;
+            }
+            mips_topn_insert(top_ix, top_sc, &n_found, n_top,
+                             item, preds[row - row_st]);
+        }
+    }
+
+    /* order the survivors by score for the output */
+    for (size_t pos = 0; pos < n_found; pos++)
+        out_order[pos] = (sparse_ix)pos;
+    ptr_real_t_glob = top_sc;
+    qsort(out_order, n_found, sizeof(sparse_ix), cmp_argsort);
+    ptr_real_t_glob = NULL;
+    for (size_t pos = 0; pos < n_found; pos++)
+    {
+        outp_ix[pos] = top_ix[out_order[pos]];
+        if (outp_score != NULL)
+            outp_score[pos] = top_sc[out_order[pos]];
+    }
+
+    cleanup:
+        free(bounds);
+        free(block_order);
+        free(preds);
+        free(top_ix);
+        free(top_sc);
+        free(out_order);
+    return retval;
+}
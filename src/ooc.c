@@ -0,0 +1,492 @@
+ /*
+    Poisson Factorization for sparse matrices
+
+    Based on alternating proximal gradient iteration or conjugate gradient.
+    Variables must be initialized from outside the main function ('run_poismf').
+    Writen for C99 standard and OpenMP 2.0 or later.
+
+    Reference paper is:
+        Cortes, David.
+        "Fast Non-Bayesian Poisson Factorization for Implicit-Feedback Recommendations."
+        arXiv preprint arXiv:1811.01908 (2018).
+
+    BSD 2-Clause License
+
+    Copyright (c) 2020, David Cortes
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#if !defined(_WIN32) && !defined(_WIN64) && !defined(_DEFAULT_SOURCE)
+    #define _DEFAULT_SOURCE /* for 'madvise' */
+#endif
+#include "poismf.h"
+#include <stdio.h>
+
+/*  Out-of-core training over memory-mapped CSR shards.
+
+    The input matrix is split by row ranges into shard files, each holding a
+    contiguous block of rows in the usual CSR layout (with the indptr array
+    rebased to start at zero). Since the alternating iterations solve each
+    row independently, a full pass over A is just the iteration function
+    applied shard by shard, with only A, B and at most two shards resident:
+    while the threads solve the current shard, the next one is already mapped
+    and advised to the kernel, so its pages stream in in the background.
+
+    The B phase works the same way over a second set of shards holding the
+    transposed matrix (i.e. the column-sparse representation, which has the
+    exact same layout on disk). */
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #define POISMF_HAS_MMAP
+#endif
+
+static const char poismf_shard_magic[8] = "POISMS\1\n";
+
+/* Sections are aligned the same way as in the model format, so that the
+   values array is suitably aligned for direct access once mapped */
+#define POISMF_SHARD_ALIGN ((size_t)4096)
+
+static size_t align_shard(size_t offset)
+{
+    return (offset + (POISMF_SHARD_ALIGN-1)) & ~(POISMF_SHARD_ALIGN-1);
+}
+
+static int write_shard_padding(FILE *f, size_t curr, size_t target)
+{
+    char zeros[256] = {0};
+    while (curr < target) {
+        size_t chunk = ((target - curr) < sizeof(zeros))?
+                        (target - curr) : sizeof(zeros);
+        if (fwrite(zeros, 1, chunk, f) != chunk) return 1;
+        curr += chunk;
+    }
+    return 0;
+}
+
+/*  Writes rows [row_st, row_end) of a CSR matrix into a shard file. The
+    indptr/indices/values arrays are the full in-memory arrays; only the
+    entries belonging to the row range are written, with the indptr entries
+    rebased so the shard is self-contained. For sharding a column-sparse
+    matrix, pass the Xc arrays and a column range instead - the layout is
+    identical. Returns 0 on success, 1 on I/O failure. */
+int poismf_shard_save
+(
+    const char *path,
+    real_t *restrict Xr, sparse_ix *restrict Xr_indptr,
+    sparse_ix *restrict Xr_indices,
+    size_t row_st, size_t row_end
+)
+{
+    size_t n_rows = row_end - row_st;
+    size_t nnz = (size_t)(Xr_indptr[row_end] - Xr_indptr[row_st]);
+    size_t ix_base = (size_t)Xr_indptr[row_st];
+
+    poismf_shard_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, poismf_shard_magic, sizeof(header.magic));
+    header.fmt_version = 1;
+    header.real_width = (uint32_t)sizeof(real_t);
+    header.ix_width = (uint32_t)sizeof(sparse_ix);
+    header.row_st = (uint64_t)row_st;
+    header.row_end = (uint64_t)row_end;
+    header.nnz = (uint64_t)nnz;
+    header.off_indptr = (uint64_t)align_shard(sizeof(header));
+    header.off_indices = (uint64_t)align_shard((size_t)header.off_indptr
+                                    + (n_rows+1)*sizeof(sparse_ix));
+    header.off_values = (uint64_t)align_shard((size_t)header.off_indices
+                                    + nnz*sizeof(sparse_ix));
+
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "Error: could not open file for writing.\n");
+        return 1;
+    }
+
+    int retval = 1;
+    if (fwrite(&header, sizeof(header), 1, f) != 1) goto cleanup;
+    if (write_shard_padding(f, sizeof(header), (size_t)header.off_indptr))
+        goto cleanup;
+    for (size_t row = 0; row <= n_rows; row++) {
+        sparse_ix rebased = (sparse_ix)((size_t)Xr_indptr[row_st + row] - ix_base);
+        if (fwrite(&rebased, sizeof(sparse_ix), 1, f) != 1) goto cleanup;
+    }
+    if (write_shard_padding(f, (size_t)header.off_indptr
+                               + (n_rows+1)*sizeof(sparse_ix),
+                            (size_t)header.off_indices)) goto cleanup;
+    if (fwrite(Xr_indices + ix_base, sizeof(sparse_ix), nnz, f) != nnz)
+        goto cleanup;
+    if (write_shard_padding(f, (size_t)header.off_indices
+                               + nnz*sizeof(sparse_ix),
+                            (size_t)header.off_values)) goto cleanup;
+    if (fwrite(Xr + ix_base, sizeof(real_t), nnz, f) != nnz) goto cleanup;
+    retval = 0;
+
+    cleanup:
+        if (retval == 1)
+            fprintf(stderr, "Error: failed to write shard file.\n");
+        if (fclose(f) != 0) retval = 1;
+    return retval;
+}
+
+/*  Maps a shard file into memory, with the array pointers in 'out' pointing
+    into the mapped pages. The mapping is advised as needed right away, so
+    the kernel starts reading it in the background - opening the next shard
+    before solving the current one is what gives the prefetch overlap.
+    On platforms without 'mmap' the shard is read into allocated memory.
+    Returns 0 on success, 1 on I/O or memory failure, 2 if the file is not a
+    shard file or was written with different type widths. */
+int poismf_shard_open(const char *path, poismf_csr_shard *restrict out)
+{
+    memset(out, 0, sizeof(*out));
+    poismf_shard_header header;
+
+    #ifdef POISMF_HAS_MMAP
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: could not open shard file.\n");
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(header)) {
+        fprintf(stderr, "Error: invalid shard file.\n");
+        close(fd);
+        return 2;
+    }
+
+    void *mapped = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); /* the mapping keeps its own reference */
+    if (mapped == MAP_FAILED) {
+        fprintf(stderr, "Error: could not memory-map shard file.\n");
+        return 1;
+    }
+
+    memcpy(&header, mapped, sizeof(header));
+    if (memcmp(header.magic, poismf_shard_magic, sizeof(header.magic)) != 0 ||
+        header.fmt_version != 1 ||
+        header.real_width != (uint32_t)sizeof(real_t) ||
+        header.ix_width != (uint32_t)sizeof(sparse_ix) ||
+        (size_t)header.off_values + (size_t)header.nnz*sizeof(real_t)
+            > (size_t)st.st_size)
+    {
+        fprintf(stderr, "Error: file is not a valid shard file for this library build.\n");
+        munmap(mapped, (size_t)st.st_size);
+        return 2;
+    }
+
+    /* start background readahead of the whole shard */
+    #ifdef MADV_WILLNEED
+    madvise(mapped, (size_t)st.st_size, MADV_WILLNEED);
+    #endif
+
+    out->mem = mapped;
+    out->mem_size = (size_t)st.st_size;
+    out->owned = false;
+    out->Xr_indptr = (sparse_ix*)((char*)mapped + header.off_indptr);
+    out->Xr_indices = (sparse_ix*)((char*)mapped + header.off_indices);
+    out->Xr = (real_t*)((char*)mapped + header.off_values);
+
+    #else
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Error: could not open shard file.\n");
+        return 1;
+    }
+    if (fread(&header, sizeof(header), 1, f) != 1 ||
+        memcmp(header.magic, poismf_shard_magic, sizeof(header.magic)) != 0 ||
+        header.fmt_version != 1 ||
+        header.real_width != (uint32_t)sizeof(real_t) ||
+        header.ix_width != (uint32_t)sizeof(sparse_ix))
+    {
+        fprintf(stderr, "Error: file is not a valid shard file for this library build.\n");
+        fclose(f);
+        return 2;
+    }
+
+    size_t n_rows = (size_t)(header.row_end - header.row_st);
+    size_t nnz = (size_t)header.nnz;
+    size_t sz_ptrs = (n_rows + 1 + nnz) * sizeof(sparse_ix);
+    out->mem = malloc(sz_ptrs + nnz*sizeof(real_t));
+    if (out->mem == NULL) {
+        fprintf(stderr, "Error: out of memory.\n");
+        fclose(f);
+        return 1;
+    }
+    out->mem_size = sz_ptrs + nnz*sizeof(real_t);
+    out->owned = true;
+    out->Xr_indptr = (sparse_ix*)out->mem;
+    out->Xr_indices = out->Xr_indptr + (n_rows + 1);
+    out->Xr = (real_t*)((char*)out->mem + sz_ptrs);
+
+    if (fseek(f, (long)header.off_indptr, SEEK_SET) != 0 ||
+        fread(out->Xr_indptr, sizeof(sparse_ix), n_rows+1, f) != n_rows+1 ||
+        fseek(f, (long)header.off_indices, SEEK_SET) != 0 ||
+        fread(out->Xr_indices, sizeof(sparse_ix), nnz, f) != nnz ||
+        fseek(f, (long)header.off_values, SEEK_SET) != 0 ||
+        fread(out->Xr, sizeof(real_t), nnz, f) != nnz)
+    {
+        fprintf(stderr, "Error: failed to read shard file.\n");
+        fclose(f);
+        free(out->mem);
+        memset(out, 0, sizeof(*out));
+        return 1;
+    }
+    fclose(f);
+    #endif
+
+    out->row_st = (size_t)header.row_st;
+    out->row_end = (size_t)header.row_end;
+    out->nnz = (size_t)header.nnz;
+    return 0;
+}
+
+void poismf_shard_close(poismf_csr_shard *restrict out)
+{
+    if (out->mem != NULL) {
+        #ifdef POISMF_HAS_MMAP
+        if (!out->owned)
+            munmap(out->mem, out->mem_size);
+        else
+        #endif
+            free(out->mem);
+    }
+    memset(out, 0, sizeof(*out));
+}
+
+extern bool should_stop_procedure;
+
+/* Runs one half-iteration (one factor matrix, all shards) with the chosen
+   method, overlapping each shard's solve with the readahead of the next */
+static int ooc_half_iteration
+(
+    real_t *A, real_t *B,
+    const char **shard_paths, size_t n_shards,
+    size_t k, real_t cnst_div, real_t *cnst_sum,
+    real_t step_size, real_t l2_reg,
+    const Method method, const bool limit_step, const size_t maxupd,
+    real_t *buffer_arr, int *buffer_int,
+    real_t *zeros_tncg, real_t *inf_tncg,
+    int nthreads
+)
+{
+    poismf_csr_shard shards[2];
+    memset(shards, 0, sizeof(shards));
+    int curr = 0;
+    int ret_code = 0;
+
+    if (poismf_shard_open(shard_paths[0], &shards[curr]) != 0)
+        return 1;
+
+    for (size_t s = 0; s < n_shards; s++)
+    {
+        /* map the next shard before solving this one - 'poismf_shard_open'
+           kicks off its readahead, which then proceeds in the background */
+        if (s + 1 < n_shards) {
+            if (poismf_shard_open(shard_paths[s+1], &shards[!curr]) != 0) {
+                ret_code = 1;
+                goto cleanup;
+            }
+        }
+
+        poismf_csr_shard *shard = &shards[curr];
+        size_t n_rows = shard->row_end - shard->row_st;
+        real_t *A_shard = A + shard->row_st*k;
+
+        switch (method) {
+            case pg:
+            {
+                pg_iteration(A_shard, B, shard->Xr, shard->Xr_indptr,
+                             shard->Xr_indices,
+                             n_rows, k, NULL, NULL, cnst_div, cnst_sum, NULL,
+                             step_size, 1., maxupd, buffer_arr, NULL, nthreads);
+                break;
+            }
+
+            case cg:
+            {
+                cg_iteration(A_shard, B, shard->Xr, shard->Xr_indptr,
+                             shard->Xr_indices,
+                             n_rows, k, NULL, NULL, limit_step, cnst_sum,
+                             l2_reg, 1., maxupd,
+                             buffer_arr, NULL, NULL, nthreads);
+                break;
+            }
+
+            case tncg:
+            {
+                tncg_iteration(A_shard, B, shard->Xr, shard->Xr_indptr,
+                               shard->Xr_indices,
+                               n_rows, k, NULL, NULL, cnst_sum, l2_reg, 1., maxupd,
+                               buffer_arr, buffer_int,
+                               zeros_tncg, inf_tncg,
+                               NULL,
+                               NULL, 0, 0,
+                               NULL, nthreads);
+                break;
+            }
+        }
+
+        poismf_shard_close(shard);
+        curr = !curr;
+
+        if (should_stop_procedure) goto cleanup;
+    }
+
+    cleanup:
+        poismf_shard_close(&shards[0]);
+        poismf_shard_close(&shards[1]);
+    return ret_code;
+}
+
+/*  Out-of-core counterpart of 'run_poismf'. Takes the same hyperparameters,
+    but the X data is given as two lists of shard file paths (see
+    'poismf_shard_save'): 'row_shards' covering all rows of X in order, and
+    'col_shards' covering all columns (i.e. shards of the transposed matrix,
+    in the same format), which drive the A and B phases respectively. The
+    shard row ranges must be non-overlapping and cover each dimension
+    exactly. Only A, B and at most two shards are held in memory at a time.
+
+    Weighted entries (w_mult != 1) are not supported here, as the weight
+    adjustment needs a full pass over X with a dimA x k working array, which
+    defeats the point of running out-of-core - use 'run_poismf_ext' for that.
+
+    Returns 0 on success, 1 on out-of-memory or I/O failure, 2 on invalid
+    inputs. */
+int run_poismf_ooc(
+    real_t *restrict A, const char **row_shards, size_t n_row_shards,
+    real_t *restrict B, const char **col_shards, size_t n_col_shards,
+    const size_t dimA, const size_t dimB, const size_t k,
+    const real_t l2_reg, const real_t l1_reg, real_t step_size,
+    const Method method, const bool limit_step, const size_t numiter, const size_t maxupd,
+    const bool handle_interrupt, const int nthreads)
+{
+    if (n_row_shards == 0 || n_col_shards == 0) {
+        fprintf(stderr, "Error: no shard files were passed.\n");
+        return 2;
+    }
+
+    real_t *cnst_sum = (real_t*) malloc(sizeof(real_t) * k);
+    real_t cnst_div;
+    int k_int = (int) k;
+    real_t neg_step_sz = -step_size;
+    size_t size_buffer = 1;
+    switch(method) {
+        case pg:   {size_buffer = 1;  break;}
+        case cg:   {size_buffer = 5;  break;}
+        case tncg: {size_buffer = 22; break;}
+    }
+    size_buffer *= (k * (size_t)nthreads);
+    real_t *buffer_arr = (real_t*) malloc(sizeof(real_t) * size_buffer);
+    int *buffer_int = NULL;
+    real_t *zeros_tncg = NULL;
+    real_t *inf_tncg = NULL;
+    int ret_code = 0;
+    should_stop_procedure = false;
+
+    if (method == tncg) {
+        buffer_int = (int*)malloc(sizeof(int) * k *(size_t)nthreads);
+        zeros_tncg = (real_t*)calloc(sizeof(real_t), k);
+        inf_tncg = (real_t*)malloc(sizeof(real_t) * k);
+        if (buffer_int == NULL || zeros_tncg == NULL || inf_tncg == NULL)
+            goto throw_oom;
+        for (size_t ix = 0; ix < k; ix++)
+            inf_tncg[ix] = HUGE_VAL;
+    }
+
+    if (buffer_arr == NULL || cnst_sum == NULL)
+    {
+        throw_oom:
+            fprintf(stderr, "Error: out of memory.\n");
+            ret_code = 1;
+            goto cleanup;
+    }
+
+    for (size_t fulliter = 0; fulliter < numiter; fulliter++){
+
+        if (handle_interrupt)
+            signal(SIGINT, set_interrup_global_variable);
+        if (should_stop_procedure) goto cleanup;
+
+        /* Constants to use later */
+        cnst_div = 1. / (1. + 2. * l2_reg * step_size);
+        sum_by_cols_parallel(cnst_sum, B, dimB, k, nthreads);
+        if (l1_reg > 0.)
+            for (size_t kk = 0; kk < k; kk++) cnst_sum[kk] += l1_reg;
+        if (method == pg)
+            cblas_tscal(k_int, neg_step_sz, cnst_sum, 1);
+
+        if (ooc_half_iteration(A, B, row_shards, n_row_shards,
+                               k, cnst_div, cnst_sum,
+                               step_size, l2_reg,
+                               method, limit_step, maxupd,
+                               buffer_arr, buffer_int,
+                               zeros_tncg, inf_tncg, nthreads))
+        {
+            ret_code = 1;
+            goto cleanup;
+        }
+
+        if (handle_interrupt)
+            signal(SIGINT, set_interrup_global_variable);
+        if (should_stop_procedure) goto cleanup;
+
+
+        /* Same procedure repeated for the B matrix */
+        sum_by_cols_parallel(cnst_sum, A, dimA, k, nthreads);
+        if (l1_reg > 0.)
+            for (size_t kk = 0; kk < k; kk++) cnst_sum[kk] += l1_reg;
+        if (method == pg)
+            cblas_tscal(k_int, neg_step_sz, cnst_sum, 1);
+
+        if (ooc_half_iteration(B, A, col_shards, n_col_shards,
+                               k, cnst_div, cnst_sum,
+                               step_size, l2_reg,
+                               method, limit_step, maxupd,
+                               buffer_arr, buffer_int,
+                               zeros_tncg, inf_tncg, nthreads))
+        {
+            ret_code = 1;
+            goto cleanup;
+        }
+
+        /* Decrease step size after taking PGD steps in both matrices */
+        if (method == pg) {
+            step_size *= 0.5;
+            neg_step_sz = -step_size;
+        }
+    }
+
+    cleanup:
+        free(cnst_sum);
+        free(buffer_arr);
+        free(buffer_int);
+        free(zeros_tncg);
+        free(inf_tncg);
+        should_stop_procedure = false;
+
+    return ret_code;
+}
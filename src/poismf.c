@@ -37,10 +37,19 @@
     OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include "poismf.h"
+#if !defined(_WIN32) && !defined(_WIN64)
+    #include <pthread.h>
+    #define POISMF_HAS_PTHREADS
+#endif
 
 /* Helper functions */
 #define nonneg(x) (((x) > 0.)? (x) : 0.)
 
+/* Upper bound (in non-zeros) on the per-thread panels of the heavy-row
+   path in 'tncg_iteration' - bounds its memory at
+   nthreads * POISMF_HEAVY_ROW_CAP * (k+1) * sizeof(real_t) */
+#define POISMF_HEAVY_ROW_CAP 65536
+
 void dscal_large(size_t n, real_t alpha, real_t *restrict x)
 {
     if (n < (size_t)INT_MAX)
@@ -59,6 +68,110 @@ void sum_by_cols(real_t *restrict out, real_t *restrict M, size_t nrow, size_t n
             out[col] += M[row*ncol + col];
 }
 
+/*  Multi-threaded 'sum_by_cols'. Each thread sums a fixed contiguous block of
+    rows into its own partial (the inner loop is contiguous and vectorizes),
+    and the partials are then reduced in thread order, so for a given
+    'nthreads' the result is deterministic. Falls back to the serial version
+    for small inputs or when the partials cannot be allocated. */
+void sum_by_cols_parallel
+(
+    real_t *restrict out, real_t *restrict M,
+    size_t nrow, size_t ncol, int nthreads
+)
+{
+    if (nthreads <= 1 || nrow < (size_t)nthreads*(size_t)4) {
+        sum_by_cols(out, M, nrow, ncol);
+        return;
+    }
+
+    real_t *restrict partials = (real_t*)calloc((size_t)nthreads * ncol,
+                                                sizeof(real_t));
+    if (partials == NULL) {
+        sum_by_cols(out, M, nrow, ncol);
+        return;
+    }
+
+    int tid;
+    #pragma omp parallel for schedule(static, 1) num_threads(nthreads) \
+            shared(partials, M, nrow, ncol, nthreads)
+    for (tid = 0; tid < nthreads; tid++)
+    {
+        size_t chunk = nrow / (size_t)nthreads;
+        size_t row_st = (size_t)tid * chunk;
+        size_t row_end = (tid == nthreads - 1)? nrow : row_st + chunk;
+        real_t *restrict partial = partials + (size_t)tid * ncol;
+        for (size_t row = row_st; row < row_end; row++)
+            for (size_t col = 0; col < ncol; col++)
+                partial[col] += M[row*ncol + col];
+    }
+
+    memcpy(out, partials, ncol*sizeof(real_t));
+    for (int t = 1; t < nthreads; t++)
+        for (size_t col = 0; col < ncol; col++)
+            out[col] += partials[(size_t)t*ncol + col];
+    free(partials);
+}
+
+/*  Incremental counterpart of 'sum_by_cols': adds to 'out' the difference
+    between the current and previous values of a subset of rows of M, so that
+    a column-sum can be kept up to date after rewriting only those rows
+    instead of rescanning the full matrix. 'rows' gives the indices of the
+    rewritten rows within M, and 'M_old' holds their previous values packed
+    contiguously in the same order (n_rows x ncol). */
+void sum_by_cols_delta
+(
+    real_t *restrict out,
+    real_t *restrict M, real_t *restrict M_old,
+    sparse_ix *restrict rows, size_t n_rows, size_t ncol
+)
+{
+    for (size_t ix = 0; ix < n_rows; ix++) {
+        real_t *restrict row_new = M + (size_t)rows[ix]*ncol;
+        real_t *restrict row_old = M_old + ix*ncol;
+        for (size_t col = 0; col < ncol; col++)
+            out[col] += row_new[col] - row_old[col];
+    }
+}
+
+/*  Tiling parameters for 'adjustment_Bsum': rows of 'Bsum_user' are built in
+    groups of 'POISMF_BSUM_TILE_ROWS', and within each group the gathers from
+    B are ordered by column range so that a panel of about
+    'POISMF_BSUM_TILE_BYTES' worth of B rows is reused from cache across the
+    whole group instead of being re-fetched from memory once per user. */
+#define POISMF_BSUM_TILE_ROWS 64
+#define POISMF_BSUM_TILE_BYTES ((size_t)262144)
+
+/*  The tiled path walks each row's non-zeros with a cursor that only moves
+    forward, which requires the column indices to be sorted within rows -
+    true for matrices built by 'poismf_build_csc_map' and by the Python/R
+    wrappers, but not something the API promises, so it gets verified. */
+static bool csr_rows_sorted
+(
+    sparse_ix Xr_indptr[], sparse_ix Xr_indices[],
+    size_t dimA, int nthreads
+)
+{
+    #if defined(_OPENMP) && ((_OPENMP < 200801) || defined(_WIN32) || defined(_WIN64)) /* OpenMP < 3.0 */
+    long long row = 0;
+    #else
+    size_t row = 0;
+    #endif
+
+    int unsorted = 0;
+    #pragma omp parallel for schedule(static) num_threads(nthreads) \
+            reduction(+:unsorted) shared(dimA, Xr_indptr, Xr_indices)
+    for (row = 0; row < dimA; row++)
+        for (size_t ix = Xr_indptr[row] + 1; ix < Xr_indptr[row + 1]; ix++)
+            unsorted += Xr_indices[ix] < Xr_indices[ix - 1];
+    return unsorted == 0;
+}
+
+/*  Builds the per-row constant for weighted fits:
+        Bsum_user[row] = (w_mult - 1) * sum(B[i] : i in X[row]) + Bsum
+    The scaling and the addition of the shared 'Bsum' are fused into the
+    same sweep that does the gathers, so 'Bsum_user' is written exactly
+    once, and the gathers themselves are tiled (see above) when the input
+    rows have sorted indices. */
 void adjustment_Bsum
 (
     real_t *restrict B,
@@ -71,114 +184,381 @@ void adjustment_Bsum
 )
 {
     #if defined(_OPENMP) && ((_OPENMP < 200801) || defined(_WIN32) || defined(_WIN64)) /* OpenMP < 3.0 */
-    long long ix = 0;
     long long row = 0;
+    long long tile = 0;
     #else
-    size_t ix = 0;
     size_t row = 0;
+    size_t tile = 0;
     #endif
 
     int k_int = (int) k;
-    memset(Bsum_user, 0, dimA*k*sizeof(real_t));
+    real_t new_w = w_mult - 1.;
+
+    if (!csr_rows_sorted(Xr_indptr, Xr_indices, dimA, nthreads))
+    {
+        #pragma omp parallel for schedule(dynamic) num_threads(nthreads) \
+                shared(dimA, Xr_indptr, Xr_indices, B, Bsum, Bsum_user, k, k_int, new_w)
+        for (row = 0; row < dimA; row++)
+        {
+            real_t *restrict out = Bsum_user + (size_t)row*k;
+            memset(out, 0, k*sizeof(real_t));
+            for (size_t ix = Xr_indptr[row]; ix < Xr_indptr[row + 1]; ix++)
+                cblas_taxpy(k_int, 1., B + Xr_indices[ix]*k, 1, out, 1);
+            for (size_t col = 0; col < k; col++)
+                out[col] = new_w * out[col] + Bsum[col];
+        }
+        return;
+    }
+
+    size_t tile_items = POISMF_BSUM_TILE_BYTES / (k * sizeof(real_t));
+    if (tile_items < POISMF_BSUM_TILE_ROWS)
+        tile_items = POISMF_BSUM_TILE_ROWS;
+    size_t n_tiles = (dimA + POISMF_BSUM_TILE_ROWS - 1) / POISMF_BSUM_TILE_ROWS;
+
     #pragma omp parallel for schedule(dynamic) num_threads(nthreads) \
-            shared(dimA, Xr_indptr, Xr_indices, B, Bsum_user, k_int)
-    for (row = 0; row < dimA; row++)
-        for (size_t ix = Xr_indptr[row]; ix < Xr_indptr[row + 1]; ix++)
-            cblas_taxpy(k_int, 1., B + Xr_indices[ix]*k, 1, Bsum_user + row*k, 1);
+            shared(dimA, n_tiles, tile_items, Xr_indptr, Xr_indices, \
+                   B, Bsum, Bsum_user, k, k_int, new_w)
+    for (tile = 0; tile < n_tiles; tile++)
+    {
+        size_t row_st = (size_t)tile * POISMF_BSUM_TILE_ROWS;
+        size_t row_end = row_st + POISMF_BSUM_TILE_ROWS;
+        row_end = (row_end > dimA)? dimA : row_end;
+        size_t n_rows = row_end - row_st;
+        size_t cursor[POISMF_BSUM_TILE_ROWS];
+        size_t n_left = 0;
+
+        memset(Bsum_user + row_st*k, 0, n_rows*k*sizeof(real_t));
+        for (size_t r = 0; r < n_rows; r++) {
+            cursor[r] = Xr_indptr[row_st + r];
+            n_left += cursor[r] < (size_t)Xr_indptr[row_st + r + 1];
+        }
 
-    size_t n = dimA * k;
-    real_t new_w = w_mult - 1.;
-    /* Note: don't use daxpy here as 'n' might be larger than INT_MAX */
-    #pragma omp parallel for schedule(static) num_threads(nthreads) \
-            shared(n, new_w, Bsum_user)
-    for (ix = 0; ix < n; ix++)
-        Bsum_user[ix] *= new_w;
-    #pragma omp parallel for schedule(static) num_threads(nthreads) \
-            shared(dimA, k, k_int, Bsum, Bsum_user)
-    for (row = 0; row < dimA; row++)
-        cblas_taxpy(k_int, 1., Bsum, 1, Bsum_user + row*k, 1);
+        while (n_left > 0)
+        {
+            /* next panel starts at the lowest still-pending column, so
+               fully-empty column ranges are skipped over */
+            size_t col_lim = SIZE_MAX;
+            for (size_t r = 0; r < n_rows; r++)
+                if (cursor[r] < (size_t)Xr_indptr[row_st + r + 1] &&
+                    (size_t)Xr_indices[cursor[r]] < col_lim)
+                {
+                    col_lim = Xr_indices[cursor[r]];
+                }
+            col_lim += tile_items;
+
+            for (size_t r = 0; r < n_rows; r++)
+            {
+                size_t ix = cursor[r];
+                size_t ix_end = Xr_indptr[row_st + r + 1];
+                if (ix >= ix_end) continue;
+                real_t *restrict out = Bsum_user + (row_st + r)*k;
+                while (ix < ix_end && (size_t)Xr_indices[ix] < col_lim) {
+                    cblas_taxpy(k_int, 1., B + (size_t)Xr_indices[ix]*k, 1, out, 1);
+                    ix++;
+                }
+                cursor[r] = ix;
+                n_left -= ix >= ix_end;
+            }
+        }
+
+        for (size_t r = 0; r < n_rows; r++) {
+            real_t *restrict out = Bsum_user + (row_st + r)*k;
+            for (size_t col = 0; col < k; col++)
+                out[col] = new_w * out[col] + Bsum[col];
+        }
+    }
 }
 
 /* Functions for Proximal Gradient */
-void calc_grad_pgd(real_t *out, real_t *curr, real_t *F, real_t *X, sparse_ix *Xind, sparse_ix nnz_this, int k)
+void calc_grad_pgd(real_t *out, real_t *curr, real_t *F, real_t *X, sparse_ix *Xind, sparse_ix *Xmap, sparse_ix nnz_this, int k)
 {
-    size_t k_szt = (size_t)k;
     memset(out, 0, sizeof(real_t) * (size_t)k);
-    for (sparse_ix ix = 0; ix < nnz_this; ix++){
-        cblas_taxpy(k, X[ix] / cblas_tdot(k, F + (size_t)Xind[ix] * k_szt, 1, curr, 1),
-                    F + (size_t)Xind[ix] * k_szt, 1, out, 1);
+    fused_grad(curr, F, X, Xind, Xmap, (size_t)nnz_this, k, 1., out);
+}
+
+/*  Builds a column-sparse view of a row-sparse X matrix which shares the
+    values array with the row-sparse representation: 'csc_map' gets, for each
+    column-ordered entry, its position inside the row-sparse values array, so
+    the values themselves are never duplicated. The resulting 'Xc_indptr' /
+    'Xc_indices' / 'csc_map' can be passed to 'run_poismf_ext' (through
+    'opts->csc_map', with the 'Xc' argument left as NULL) to halve the memory
+    spent on the input data.
+
+    All output arrays are allocated by the caller: 'Xc_indptr' with dimB+1
+    entries, 'Xc_indices' and 'csc_map' with as many entries as non-zeros.
+    Returns 0 on success, 1 on out-of-memory (a temporary array of dimB
+    counters is needed). */
+int poismf_build_csc_map
+(
+    sparse_ix *restrict Xr_indptr, sparse_ix *restrict Xr_indices,
+    size_t dimA, size_t dimB,
+    sparse_ix *restrict Xc_indptr, sparse_ix *restrict Xc_indices,
+    sparse_ix *restrict csc_map
+)
+{
+    sparse_ix *restrict cursor = (sparse_ix*)calloc(dimB, sizeof(sparse_ix));
+    if (cursor == NULL) {
+        fprintf(stderr, "Error: out of memory.\n");
+        return 1;
+    }
+
+    size_t nnz = (size_t)Xr_indptr[dimA];
+    for (size_t ix = 0; ix < nnz; ix++)
+        cursor[Xr_indices[ix]]++;
+    Xc_indptr[0] = 0;
+    for (size_t col = 0; col < dimB; col++) {
+        Xc_indptr[col + 1] = Xc_indptr[col] + cursor[col];
+        cursor[col] = Xc_indptr[col];
+    }
+
+    for (size_t row = 0; row < dimA; row++)
+        for (size_t ix = Xr_indptr[row]; ix < (size_t)Xr_indptr[row + 1]; ix++)
+        {
+            sparse_ix pos = cursor[Xr_indices[ix]]++;
+            Xc_indices[pos] = (sparse_ix)row;
+            csc_map[pos] = (sparse_ix)ix;
+        }
+
+    free(cursor);
+    return 0;
+}
+
+/* Training telemetry (see 'poismf_stats' in the header). Each parallel
+   iteration collects into per-thread partials and folds them into the
+   caller-visible struct once at the end, so the loop bodies only touch
+   thread-local memory. If the partials cannot be allocated, collection is
+   simply skipped - telemetry must never fail a fit. */
+typedef struct poismf_tstats {
+    uint64_t rows_solved;
+    uint64_t rows_hit_maxupd;
+    uint64_t hist_nfeval[POISMF_STATS_BINS];
+    uint64_t hist_niter[POISMF_STATS_BINS];
+    double flops_est;
+} poismf_tstats;
+
+void poismf_stats_init(poismf_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+static int stats_bin(uint64_t v)
+{
+    int b = 0;
+    while (v != 0 && b < POISMF_STATS_BINS-1) {
+        v >>= 1;
+        b++;
+    }
+    return b;
+}
+
+static poismf_tstats* stats_alloc_partials(poismf_stats *stats, int nthreads)
+{
+    if (stats == NULL) return NULL;
+    return (poismf_tstats*)calloc((size_t)nthreads, sizeof(poismf_tstats));
+}
+
+static void stats_count_row
+(
+    poismf_tstats *tl,
+    uint64_t niter, uint64_t nfeval, bool hit_maxupd,
+    double flops
+)
+{
+    tl->rows_solved++;
+    tl->rows_hit_maxupd += hit_maxupd;
+    tl->hist_niter[stats_bin(niter)]++;
+    tl->hist_nfeval[stats_bin(nfeval)]++;
+    tl->flops_est += flops;
+}
+
+static void stats_merge_partials
+(
+    poismf_stats *stats,
+    poismf_tstats *tl, int nthreads,
+    uint64_t rows_skipped
+)
+{
+    if (stats == NULL) return;
+    stats->rows_skipped += rows_skipped;
+    if (tl == NULL) return;
+    for (int t = 0; t < nthreads; t++) {
+        stats->rows_solved += tl[t].rows_solved;
+        stats->rows_hit_maxupd += tl[t].rows_hit_maxupd;
+        for (int b = 0; b < POISMF_STATS_BINS; b++) {
+            stats->hist_nfeval[b] += tl[t].hist_nfeval[b];
+            stats->hist_niter[b] += tl[t].hist_niter[b];
+        }
+        stats->flops_est += tl[t].flops_est;
+    }
+    free(tl);
+}
+
+/*  NUMA support. On multi-socket machines, first-touch page placement puts
+    each page on the node of the thread that writes it first, so a factor
+    matrix filled by one thread ends up entirely on one memory controller.
+    'poismf_first_touch' zeroes a freshly-allocated matrix in parallel using
+    the same contiguous per-thread row partition that the solver loops use
+    when 'numa_local' is enabled, so each socket's threads both place and
+    later solve the same rows (run with the training thread count and with
+    threads pinned, e.g. OMP_PROC_BIND=true). In that mode the row loops
+    switch from dynamic scheduling to this fixed partition, trading the
+    load balancing of 'sort_rows_by_nnz' for node-local row traffic. */
+static void numa_chunk
+(
+    size_t n, int tid, int nthreads,
+    size_t *restrict row_st, size_t *restrict row_end
+)
+{
+    size_t chunk = n / (size_t)nthreads;
+    *row_st = (size_t)tid * chunk;
+    *row_end = (tid == nthreads - 1)? n : *row_st + chunk;
+}
+
+/* Toggled by 'run_poismf_ext' around a fit with 'numa_local' set
+   (same pattern as 'should_stop_procedure') */
+static bool numa_static_rows = false;
+
+void poismf_first_touch(real_t *restrict M, size_t nrow, size_t ncol, int nthreads)
+{
+    if (nthreads <= 1 || nrow < (size_t)nthreads) {
+        memset(M, 0, nrow*ncol*sizeof(real_t));
+        return;
+    }
+    int tid;
+    #pragma omp parallel for schedule(static, 1) num_threads(nthreads) \
+            shared(M, nrow, ncol, nthreads)
+    for (tid = 0; tid < nthreads; tid++)
+    {
+        size_t row_st, row_end;
+        numa_chunk(nrow, tid, nthreads, &row_st, &row_end);
+        memset(M + row_st*ncol, 0, (row_end - row_st)*ncol*sizeof(real_t));
     }
 }
 
 /*  This function is written having in mind the A matrix being optimized,
     with the B matrix being fixed, and the data passed in row-sparse format.
     For optimizing B, swap any mention of A and B, and pass the data in
-    column-sparse format */
+    column-sparse format.
+
+    'row_order' (here and in the cg/tncg counterparts) optionally gives the
+    order in which rows are dispatched to the threads (NULL = natural order).
+    Since rows are solved independently, the results do not depend on it, but
+    handing out the heaviest rows first avoids the situation where a huge row
+    picked up at the tail end of the dynamic loop leaves one thread grinding
+    alone while the others idle. */
+static int pg_solve_one
+(
+    size_t ia, real_t *A, real_t *B,
+    real_t *Xr, sparse_ix *Xr_indptr, sparse_ix *Xr_indices, sparse_ix *Xr_map,
+    size_t k, int k_int, real_t cnst_div, real_t *cnst_sum, real_t *Bsum_user,
+    real_t step_size, real_t w_mult, size_t maxupd,
+    real_t *buffer_arr, poismf_tstats *tl
+)
+{
+    sparse_ix nnz_this = Xr_indptr[ia + 1] - Xr_indptr[ia];
+    if (nnz_this == 0) {
+        memset(A + ia*k, 0, k*sizeof(real_t));
+        return 1;
+    }
+    real_t *Bsum = (w_mult != 1.)? (Bsum_user + ia*k) : cnst_sum;
+    if (tl != NULL)
+        stats_count_row(tl + omp_get_thread_num(),
+                        (uint64_t)maxupd, (uint64_t)maxupd, false,
+                        (double)maxupd * (4.*(double)k*(double)nnz_this
+                                          + 6.*(double)k));
+
+    for (size_t p = 0; p < maxupd; p++)
+    {
+        calc_grad_pgd(buffer_arr + k*omp_get_thread_num(),
+                      A + ia*k, B,
+                      (Xr_map == NULL)? (Xr + Xr_indptr[ia]) : Xr,
+                      Xr_indices + Xr_indptr[ia],
+                      (Xr_map == NULL)? NULL : (Xr_map + Xr_indptr[ia]),
+                      nnz_this, k_int);
+        cblas_taxpy(k_int, step_size,
+                    buffer_arr + k*omp_get_thread_num(), 1,
+                    A + ia*k, 1);
+
+        cblas_taxpy(k_int, 1., Bsum, 1, A + ia*k, 1);
+        cblas_tscal(k_int, cnst_div, A + ia*k, 1);
+        for (size_t ix = 0; ix < k; ix++)
+            A[ia*k + ix] = nonneg(A[ia*k + ix]);
+    }
+    return 0;
+}
+
 void pg_iteration
 (
     real_t *A, real_t *B,
     real_t *Xr, sparse_ix *Xr_indptr, sparse_ix *Xr_indices,
-    size_t dimA, size_t k,
+    size_t dimA, size_t k, sparse_ix *row_order, sparse_ix *Xr_map,
     real_t cnst_div, real_t *cnst_sum, real_t *Bsum_user,
     real_t step_size, real_t w_mult, size_t maxupd,
-    real_t *buffer_arr, int nthreads
+    real_t *buffer_arr, poismf_stats *stats, int nthreads
 )
 {
     int k_int = (int) k;
-    sparse_ix nnz_this;
+    size_t ia;
     step_size *= w_mult;
-
-    real_t *Bsum = cnst_sum;
+    poismf_tstats *tl = stats_alloc_partials(stats, nthreads);
+    uint64_t rows_skipped = 0;
 
     #if defined(_OPENMP) && ((_OPENMP < 200801) || defined(_WIN32) || defined(_WIN64)) /* OpenMP < 3.0 */
-    long long ia;
+    long long row;
     #endif
 
-    #pragma omp parallel for schedule(dynamic) num_threads(nthreads) \
-            firstprivate(Bsum) private(nnz_this) \
-            shared(A, B, k, k_int, cnst_div, Bsum_user, maxupd, Xr, Xr_indptr, Xr_indices)
-    for (size_t_for ia = 0; ia < dimA; ia++)
+    if (numa_static_rows && nthreads > 1)
     {
-
-        nnz_this = Xr_indptr[ia + 1] - Xr_indptr[ia];
-        if (nnz_this == 0) {
-            memset(A + ia*k, 0, k*sizeof(real_t));
-            continue;
+        int tid;
+        #pragma omp parallel for schedule(static, 1) num_threads(nthreads) \
+                shared(A, B, k, k_int, cnst_div, cnst_sum, Bsum_user, maxupd, Xr, Xr_indptr, Xr_indices, Xr_map, buffer_arr, tl, dimA, nthreads, step_size, w_mult) \
+                reduction(+:rows_skipped)
+        for (tid = 0; tid < nthreads; tid++)
+        {
+            size_t row_st, row_end;
+            numa_chunk(dimA, tid, nthreads, &row_st, &row_end);
+            for (size_t ia_st = row_st; ia_st < row_end; ia_st++)
+                rows_skipped += pg_solve_one(ia_st, A, B,
+                                             Xr, Xr_indptr, Xr_indices, Xr_map,
+                                             k, k_int, cnst_div, cnst_sum,
+                                             Bsum_user, step_size, w_mult,
+                                             maxupd, buffer_arr, tl);
         }
-        if (w_mult != 1.) Bsum = Bsum_user + ia*k;
+    }
 
-        for (size_t p = 0; p < maxupd; p++)
+    else
+    {
+        #pragma omp parallel for schedule(dynamic) num_threads(nthreads) \
+                private(ia) \
+                shared(A, B, k, k_int, cnst_div, cnst_sum, Bsum_user, maxupd, Xr, Xr_indptr, Xr_indices, row_order, Xr_map, buffer_arr, tl, step_size, w_mult) \
+                reduction(+:rows_skipped)
+        for (size_t_for row = 0; row < dimA; row++)
         {
-            calc_grad_pgd(buffer_arr + k*omp_get_thread_num(),
-                          A + ia*k, B, Xr + Xr_indptr[ia],
-                          Xr_indices + Xr_indptr[ia], nnz_this, k_int);
-            cblas_taxpy(k_int, step_size,
-                        buffer_arr + k*omp_get_thread_num(), 1,
-                        A + ia*k, 1);
-
-            cblas_taxpy(k_int, 1., Bsum, 1, A + ia*k, 1);
-            cblas_tscal(k_int, cnst_div, A + ia*k, 1);
-            for (size_t ix = 0; ix < k; ix++)
-                A[ia*k + ix] = nonneg(A[ia*k + ix]);
+            ia = (row_order == NULL)? (size_t)row : (size_t)row_order[row];
+            rows_skipped += pg_solve_one(ia, A, B,
+                                         Xr, Xr_indptr, Xr_indices, Xr_map,
+                                         k, k_int, cnst_div, cnst_sum,
+                                         Bsum_user, step_size, w_mult,
+                                         maxupd, buffer_arr, tl);
         }
-
     }
+
+    stats_merge_partials(stats, tl, nthreads, rows_skipped);
 }
 
 /* Functions for Conjugate Gradient */
 void calc_fun_single(real_t a_row[], int k_int, real_t *f, void *data)
 {
     fdata* fun_data = (fdata*) data;
-    size_t k = (size_t)k_int;
     real_t reg_term = cblas_tdot(k_int, fun_data->Bsum, 1, a_row, 1);
     reg_term += fun_data->l2_reg * cblas_tdot(k_int, a_row, 1, a_row, 1);
-    real_t lsum = 0.;
-    for (size_t ix = 0; ix < fun_data->nnz_this; ix++)
-    {
-        lsum += fun_data->Xr[ix]
-                 * log( cblas_tdot(k_int, a_row, 1,
-                                   fun_data->B + fun_data->X_ind[ix]*k, 1) );
-    }
+    real_t lsum = (fun_data->B_pack != NULL)?
+        fused_fun_packed(a_row, fun_data->B_pack,
+                         fun_data->Xr, fun_data->X_ind, fun_data->X_map,
+                         (size_t)fun_data->nnz_this, k_int)
+      : fused_fun(a_row, fun_data->B,
+                  fun_data->Xr, fun_data->X_ind, fun_data->X_map,
+                  (size_t)fun_data->nnz_this, k_int);
     *f = reg_term - lsum * fun_data->w_mult;
 }
 
@@ -188,13 +568,16 @@ void calc_grad_single(real_t a_row[], int k_int, real_t grad[], void *data)
     size_t k = (size_t)k_int;
     memcpy(grad, fun_data->Bsum, sizeof(real_t) * k);
     cblas_taxpy(k_int, 2. * fun_data->l2_reg, a_row, 1, grad, 1);
-    for (size_t ix = 0; ix < fun_data->nnz_this; ix++)
-    {
-        cblas_taxpy(k_int, - fun_data->Xr[ix]
-                             / cblas_tdot(k_int, a_row, 1,
-                                          fun_data->B + fun_data->X_ind[ix]*k, 1),
-                    fun_data->B + fun_data->X_ind[ix]*k, 1, grad, 1);
-    }
+    if (fun_data->B_pack != NULL)
+        fused_grad_packed(a_row, fun_data->B_pack,
+                          fun_data->Xr, fun_data->X_ind, fun_data->X_map,
+                          (size_t)fun_data->nnz_this, k_int,
+                          -1., grad);
+    else
+        fused_grad(a_row, fun_data->B,
+                   fun_data->Xr, fun_data->X_ind, fun_data->X_map,
+                   (size_t)fun_data->nnz_this, k_int,
+                   -1., grad);
 }
 
 void calc_grad_single_w(real_t a_row[], int k_int, real_t grad[], void *data)
@@ -202,13 +585,16 @@ void calc_grad_single_w(real_t a_row[], int k_int, real_t grad[], void *data)
     fdata* fun_data = (fdata*) data;
     size_t k = (size_t)k_int;
     memset(grad, 0, k*sizeof(real_t));
-    for (size_t ix = 0; ix < fun_data->nnz_this; ix++)
-    {
-        cblas_taxpy(k_int, - fun_data->Xr[ix]
-                             / cblas_tdot(k_int, a_row, 1,
-                                          fun_data->B + fun_data->X_ind[ix]*k, 1),
-                    fun_data->B + fun_data->X_ind[ix]*k, 1, grad, 1);
-    }
+    if (fun_data->B_pack != NULL)
+        fused_grad_packed(a_row, fun_data->B_pack,
+                          fun_data->Xr, fun_data->X_ind, fun_data->X_map,
+                          (size_t)fun_data->nnz_this, k_int,
+                          -1., grad);
+    else
+        fused_grad(a_row, fun_data->B,
+                   fun_data->Xr, fun_data->X_ind, fun_data->X_map,
+                   (size_t)fun_data->nnz_this, k_int,
+                   -1., grad);
     cblas_tscal(k_int, fun_data->w_mult, grad, 1);
     cblas_taxpy(k_int, 1., fun_data->Bsum, 1, grad, 1);
     cblas_taxpy(k_int, 2. * fun_data->l2_reg, a_row, 1, grad, 1);
@@ -226,15 +612,62 @@ int calc_fun_and_grad
     int k_int = fun_data->k;
     size_t k = (size_t)k_int;
 
-    real_t pred;
-    real_t lsum = 0;
-    memset(grad, 0, k*sizeof(real_t));
-    for (size_t ix = 0; ix < fun_data->nnz_this; ix++)
+    real_t lsum;
+    if (fun_data->Bpanel == NULL)
     {
-        pred = cblas_tdot(k_int, a_row, 1, fun_data->B + fun_data->X_ind[ix]*k, 1);
-        cblas_taxpy(k_int, - fun_data->Xr[ix] / pred,
-                    fun_data->B + fun_data->X_ind[ix]*k, 1, grad, 1);
-        lsum += fun_data->Xr[ix] * log(pred);
+        memset(grad, 0, k*sizeof(real_t));
+        if (fun_data->B_pack != NULL)
+            lsum = fused_fun_grad_packed(a_row, fun_data->B_pack,
+                                         fun_data->Xr, fun_data->X_ind,
+                                         fun_data->X_map,
+                                         (size_t)fun_data->nnz_this, k_int,
+                                         grad);
+        else
+            lsum = fused_fun_grad(a_row, fun_data->B,
+                                  fun_data->Xr, fun_data->X_ind,
+                                  fun_data->X_map,
+                                  (size_t)fun_data->nnz_this, k_int,
+                                  grad);
+    }
+
+    /*  Heavy-row path: the B rows for this row's non-zeros were gathered
+        beforehand into a contiguous panel, so instead of re-walking the
+        sparse data (one random gather per non-zero per evaluation), the
+        predictions and the gradient come from two dense GEMVs over the
+        panel, which stream sequentially and re-use it from cache across
+        the solver's repeated evaluations. */
+    else
+    {
+        int nnz_int = (int) fun_data->nnz_this;
+        size_t nnz = (size_t) fun_data->nnz_this;
+        real_t *restrict preds = fun_data->pred_buffer;
+        real_t logs[POISMF_LOG_STRIP];
+        real_t xval;
+        lsum = 0;
+        cblas_tgemv(CblasRowMajor, CblasNoTrans,
+                    nnz_int, k_int,
+                    1., fun_data->Bpanel, k_int,
+                    a_row, 1,
+                    0., preds, 1);
+        for (size_t st = 0; st < nnz; st += POISMF_LOG_STRIP)
+        {
+            size_t n_strip = nnz - st;
+            n_strip = (n_strip > POISMF_LOG_STRIP)? POISMF_LOG_STRIP : n_strip;
+            poismf_vlog(preds + st, logs, n_strip);
+            for (size_t i = 0; i < n_strip; i++)
+            {
+                size_t ix = st + i;
+                xval = (fun_data->X_map == NULL)?
+                        fun_data->Xr[ix] : fun_data->Xr[fun_data->X_map[ix]];
+                lsum += xval * logs[i];
+                preds[ix] = - xval / preds[ix];
+            }
+        }
+        cblas_tgemv(CblasRowMajor, CblasTrans,
+                    nnz_int, k_int,
+                    1., fun_data->Bpanel, k_int,
+                    preds, 1,
+                    0., grad, 1);
     }
 
     if (fun_data->w_mult != 1.)
@@ -247,105 +680,431 @@ int calc_fun_and_grad
     return 0;
 }
 
+static int cg_solve_one
+(
+    size_t ia, real_t *A, fdata data,
+    real_t *Xr, sparse_ix *Xr_indptr, sparse_ix *Xr_indices, sparse_ix *Xr_map,
+    size_t k, bool limit_step, size_t maxupd, grad_eval *grad_fun,
+    real_t *buffer_arr, real_t *Bsum_w, real_t w_mult, poismf_tstats *tl
+)
+{
+    real_t fun_val;
+    size_t niter;
+    size_t nfeval;
+    data.Xr = (Xr_map == NULL)? (Xr + Xr_indptr[ia]) : Xr;
+    data.X_map = (Xr_map == NULL)? NULL : (Xr_map + Xr_indptr[ia]);
+    data.X_ind = Xr_indices + Xr_indptr[ia];
+    data.nnz_this = Xr_indptr[ia + 1] - Xr_indptr[ia];
+
+    if (data.nnz_this == 0) {
+        memset(A + ia*k, 0, k*sizeof(real_t));
+        return 1;
+    }
+
+    if (w_mult != 1.) data.Bsum = Bsum_w + ia*k;
+
+    minimize_nonneg_cg(
+        A + ia*k, data.k, &fun_val,
+        calc_fun_single, grad_fun, NULL, (void*) &data,
+        1e-2, 150, maxupd, &niter, &nfeval,
+        0.25, 0.01, 20, limit_step,
+        buffer_arr + 5*k*omp_get_thread_num(), 1, 0);
+
+    if (tl != NULL)
+        stats_count_row(tl + omp_get_thread_num(),
+                        (uint64_t)niter, (uint64_t)nfeval,
+                        niter >= maxupd,
+                        (double)nfeval * 4.*(double)k
+                                       * (double)data.nnz_this);
+    return 0;
+}
+
 void cg_iteration
 (
     real_t *A, real_t *B,
     real_t *Xr, sparse_ix *Xr_indptr, sparse_ix *Xr_indices,
-    size_t dimA, size_t k, bool limit_step,
+    size_t dimA, size_t k, sparse_ix *row_order, sparse_ix *Xr_map, bool limit_step,
     real_t *Bsum, real_t l2_reg, real_t w_mult, size_t maxupd,
-    real_t *buffer_arr, real_t *Bsum_w, int nthreads
+    real_t *buffer_arr, real_t *Bsum_w, poismf_stats *stats, int nthreads
 )
 {
     int k_int = (int) k;
 
-    fdata data = { B, Bsum, NULL, NULL, 0, l2_reg, w_mult, k_int };
-    real_t fun_val;
-    size_t niter;
-    size_t nfeval;
+    fdata data = { B, Bsum, NULL, NULL, NULL, 0, l2_reg, w_mult, k_int };
+    size_t ia;
+    poismf_tstats *tl = stats_alloc_partials(stats, nthreads);
+    uint64_t rows_skipped = 0;
     grad_eval *grad_fun = (w_mult == 1.)? calc_grad_single : calc_grad_single_w;
 
     #if defined(_OPENMP) && ((_OPENMP < 200801) || defined(_WIN32) || defined(_WIN64))
-    long long ia;
+    long long row;
     #endif
 
-    #pragma omp parallel for schedule(dynamic) num_threads(nthreads) \
-            private(fun_val, niter, nfeval) firstprivate(data) \
-            shared(dimA, Xr, Xr_indptr, Xr_indices, A, k, k_int, grad_fun)
-    for (size_t_for ia = 0; ia < dimA; ia++)
+    if (numa_static_rows && nthreads > 1)
     {
-        data.Xr = Xr + Xr_indptr[ia];
-        data.X_ind = Xr_indices + Xr_indptr[ia];
-        data.nnz_this = Xr_indptr[ia + 1] - Xr_indptr[ia];
+        int tid;
+        #pragma omp parallel for schedule(static, 1) num_threads(nthreads) \
+                firstprivate(data) \
+                shared(dimA, Xr, Xr_indptr, Xr_indices, A, k, grad_fun, Xr_map, tl, maxupd, buffer_arr, Bsum_w, w_mult, limit_step, nthreads) \
+                reduction(+:rows_skipped)
+        for (tid = 0; tid < nthreads; tid++)
+        {
+            size_t row_st, row_end;
+            numa_chunk(dimA, tid, nthreads, &row_st, &row_end);
+            for (size_t ia_st = row_st; ia_st < row_end; ia_st++)
+                rows_skipped += cg_solve_one(ia_st, A, data,
+                                             Xr, Xr_indptr, Xr_indices, Xr_map,
+                                             k, limit_step, maxupd, grad_fun,
+                                             buffer_arr, Bsum_w, w_mult, tl);
+        }
+    }
 
-        if (data.nnz_this == 0) {
-            memset(A + ia*k, 0, k*sizeof(real_t));
-            continue;
+    else
+    {
+        #pragma omp parallel for schedule(dynamic) num_threads(nthreads) \
+                private(ia) firstprivate(data) \
+                shared(dimA, Xr, Xr_indptr, Xr_indices, A, k, grad_fun, row_order, Xr_map, tl, maxupd, buffer_arr, Bsum_w, w_mult, limit_step) \
+                reduction(+:rows_skipped)
+        for (size_t_for row = 0; row < dimA; row++)
+        {
+            ia = (row_order == NULL)? (size_t)row : (size_t)row_order[row];
+            rows_skipped += cg_solve_one(ia, A, data,
+                                         Xr, Xr_indptr, Xr_indices, Xr_map,
+                                         k, limit_step, maxupd, grad_fun,
+                                         buffer_arr, Bsum_w, w_mult, tl);
         }
+    }
+
+    stats_merge_partials(stats, tl, nthreads, rows_skipped);
+}
+
+static int tncg_solve_one
+(
+    size_t ia, real_t *A, real_t *B, fdata data,
+    real_t *Xr, sparse_ix *Xr_indptr, sparse_ix *Xr_indices, sparse_ix *Xr_map,
+    size_t k, int maxupd, int maxCGit,
+    real_t *buffer_arr, int *buffer_int,
+    real_t *zeros_tncg, real_t *inf_tncg,
+    real_t *Bsum_w, real_t w_mult,
+    real_t *heavy_buffer, size_t heavy_thresh, size_t heavy_cap,
+    poismf_tstats *tl
+)
+{
+    real_t fun_val = 0;
+    int niter = 0;
+    int nfeval = 0;
+    data.Xr = (Xr_map == NULL)? (Xr + Xr_indptr[ia]) : Xr;
+    data.X_map = (Xr_map == NULL)? NULL : (Xr_map + Xr_indptr[ia]);
+    data.X_ind = Xr_indices + Xr_indptr[ia];
+    data.nnz_this = Xr_indptr[ia + 1] - Xr_indptr[ia];
+
+    if (data.nnz_this == 0) {
+        memset(A + ia*k, 0, k*sizeof(real_t));
+        return 1;
+    }
 
-        if (w_mult != 1.) data.Bsum = Bsum_w + ia*k;
+    if (w_mult != 1.) data.Bsum = Bsum_w + ia*k;
 
-        minimize_nonneg_cg(
-            A + ia*k, k_int, &fun_val,
-            calc_fun_single, grad_fun, NULL, (void*) &data,
-            1e-2, 150, maxupd, &niter, &nfeval,
-            0.25, 0.01, 20, limit_step,
-            buffer_arr + 5*k*omp_get_thread_num(), 1, 0);
+    data.Bpanel = NULL;
+    data.pred_buffer = NULL;
+    if (heavy_buffer != NULL &&
+        (size_t)data.nnz_this >= heavy_thresh &&
+        (size_t)data.nnz_this <= heavy_cap)
+    {
+        real_t *restrict panel = heavy_buffer
+                                  + (size_t)omp_get_thread_num()
+                                     * heavy_cap * (k + (size_t)1);
+        for (size_t ix = 0; ix < (size_t)data.nnz_this; ix++)
+            memcpy(panel + ix*k, B + (size_t)data.X_ind[ix]*k,
+                   k*sizeof(real_t));
+        data.Bpanel = panel;
+        data.pred_buffer = panel + heavy_cap*k;
     }
+
+    tnc(data.k, A + ia*k, &fun_val,
+        buffer_arr + (size_t)omp_get_thread_num()*(size_t)22*k + (size_t)21*k,
+        calc_fun_and_grad, (void*) &data,
+        zeros_tncg, inf_tncg, NULL, NULL,
+        0, maxCGit, maxupd, 0.25, 10.,
+        0., 0., 1e-4, -1., -1.,
+        1.3, &nfeval, &niter,
+        buffer_arr + (size_t)omp_get_thread_num()*(size_t)22*k,
+        buffer_int + (size_t)omp_get_thread_num()*k);
+
+    if (tl != NULL)
+        stats_count_row(tl + omp_get_thread_num(),
+                        (uint64_t)niter, (uint64_t)nfeval,
+                        nfeval >= maxupd,
+                        (double)nfeval * 4.*(double)k
+                                       * (double)data.nnz_this);
+    return 0;
 }
 
 void tncg_iteration
 (
     real_t *A, real_t *B,
     real_t *Xr, sparse_ix *Xr_indptr, sparse_ix *Xr_indices,
-    size_t dimA, size_t k,
+    size_t dimA, size_t k, sparse_ix *row_order, sparse_ix *Xr_map,
     real_t *Bsum, real_t l2_reg, real_t w_mult, int maxupd,
     real_t *buffer_arr, int *buffer_int,
     real_t *zeros_tncg, real_t *inf_tncg,
-    real_t *Bsum_w, int nthreads
+    real_t *Bsum_w,
+    real_t *heavy_buffer, size_t heavy_thresh, size_t heavy_cap,
+    poismf_stats *stats, int nthreads
 )
 {
     int k_int = (int) k;
 
-    fdata data = { B, Bsum, NULL, NULL, 0, l2_reg, w_mult, k_int };
-    real_t fun_val = 0;
-    int niter = 0;
-    int nfeval = 0;
+    fdata data = { B, Bsum, NULL, NULL, NULL, 0, l2_reg, w_mult, k_int };
+    size_t ia;
     int maxCGit = (int) fmax(1., fmin(50., (real_t)k/2.));
+    poismf_tstats *tl = stats_alloc_partials(stats, nthreads);
+    uint64_t rows_skipped = 0;
 
     #if defined(_OPENMP) && ((_OPENMP < 200801) || defined(_WIN32) || defined(_WIN64))
-    long long ia;
+    long long row;
     #endif
 
-    #pragma omp parallel for schedule(dynamic) num_threads(nthreads) \
-            firstprivate(data) private(niter, nfeval, fun_val) \
-            shared(A, dimA, Bsum_w, k, k_int, zeros_tncg, inf_tncg, \
-                   buffer_arr, buffer_int, Xr, Xr_indices, Xr_indptr, \
-                   maxupd, w_mult)
-    for (size_t_for ia = 0; ia < dimA; ia++)
+    if (numa_static_rows && nthreads > 1)
     {
-        data.Xr = Xr + Xr_indptr[ia];
-        data.X_ind = Xr_indices + Xr_indptr[ia];
-        data.nnz_this = Xr_indptr[ia + 1] - Xr_indptr[ia];
+        int tid;
+        #pragma omp parallel for schedule(static, 1) num_threads(nthreads) \
+                firstprivate(data) \
+                shared(A, B, dimA, Bsum_w, k, zeros_tncg, inf_tncg, \
+                       buffer_arr, buffer_int, Xr, Xr_indices, Xr_indptr, \
+                       maxupd, maxCGit, w_mult, Xr_map, nthreads, \
+                       heavy_buffer, heavy_thresh, heavy_cap, tl) \
+                reduction(+:rows_skipped)
+        for (tid = 0; tid < nthreads; tid++)
+        {
+            size_t row_st, row_end;
+            numa_chunk(dimA, tid, nthreads, &row_st, &row_end);
+            for (size_t ia_st = row_st; ia_st < row_end; ia_st++)
+                rows_skipped += tncg_solve_one(ia_st, A, B, data,
+                                               Xr, Xr_indptr, Xr_indices,
+                                               Xr_map, k, maxupd, maxCGit,
+                                               buffer_arr, buffer_int,
+                                               zeros_tncg, inf_tncg,
+                                               Bsum_w, w_mult,
+                                               heavy_buffer, heavy_thresh,
+                                               heavy_cap, tl);
+        }
+    }
 
-        if (data.nnz_this == 0) {
-            memset(A + ia*k, 0, k*sizeof(real_t));
-            continue;
+    else
+    {
+        #pragma omp parallel for schedule(dynamic) num_threads(nthreads) \
+                firstprivate(data) private(ia) \
+                shared(A, B, dimA, Bsum_w, k, zeros_tncg, inf_tncg, \
+                       buffer_arr, buffer_int, Xr, Xr_indices, Xr_indptr, \
+                       maxupd, maxCGit, w_mult, row_order, Xr_map, \
+                       heavy_buffer, heavy_thresh, heavy_cap, tl) \
+                reduction(+:rows_skipped)
+        for (size_t_for row = 0; row < dimA; row++)
+        {
+            ia = (row_order == NULL)? (size_t)row : (size_t)row_order[row];
+            rows_skipped += tncg_solve_one(ia, A, B, data,
+                                           Xr, Xr_indptr, Xr_indices,
+                                           Xr_map, k, maxupd, maxCGit,
+                                           buffer_arr, buffer_int,
+                                           zeros_tncg, inf_tncg,
+                                           Bsum_w, w_mult,
+                                           heavy_buffer, heavy_thresh,
+                                           heavy_cap, tl);
         }
+    }
 
-        if (w_mult != 1.) data.Bsum = Bsum_w + ia*k;
+    stats_merge_partials(stats, tl, nthreads, rows_skipped);
+}
+
+/* Comparator for ordering rows by their non-zero counts (heaviest first).
+   The indptr array is passed through a global, as qsort takes no context
+   argument (this runs single-threaded, before the parallel loops). */
+static sparse_ix *ptr_indptr_glob = NULL;
+static int cmp_rows_by_nnz(const void *a, const void *b)
+{
+    size_t nnz1 = ptr_indptr_glob[*((sparse_ix*)a) + 1]
+                   - ptr_indptr_glob[*((sparse_ix*)a)];
+    size_t nnz2 = ptr_indptr_glob[*((sparse_ix*)b) + 1]
+                   - ptr_indptr_glob[*((sparse_ix*)b)];
+    return (nnz1 == nnz2)? 0 : ((nnz1 < nnz2)? 1 : -1);
+}
 
-        tnc(k_int, A + ia*k, &fun_val,
-            buffer_arr + (size_t)omp_get_thread_num()*(size_t)22*k + (size_t)21*k,
-            calc_fun_and_grad, (void*) &data,
-            zeros_tncg, inf_tncg, NULL, NULL,
-            0, maxCGit, maxupd, 0.25, 10.,
-            0., 0., 1e-4, -1., -1.,
-            1.3, &nfeval, &niter,
-            buffer_arr + (size_t)omp_get_thread_num()*(size_t)22*k,
-            buffer_int + (size_t)omp_get_thread_num()*k);
+static sparse_ix* build_row_order(sparse_ix *indptr, size_t dim)
+{
+    sparse_ix *order = (sparse_ix*)malloc(dim * sizeof(sparse_ix));
+    if (order == NULL) return NULL;
+    for (size_t ix = 0; ix < dim; ix++)
+        order[ix] = (sparse_ix)ix;
+    ptr_indptr_glob = indptr;
+    qsort(order, dim, sizeof(sparse_ix), cmp_rows_by_nnz);
+    ptr_indptr_glob = NULL;
+    return order;
+}
+
+/* Fills in the default options for 'run_poismf_ext' */
+/*  Solver workspace (see the struct in the header). All buffers carved from
+    the slab start on a cache-line boundary so per-thread slices never share
+    lines; the total is computed by the same routine that later carves, so
+    the two cannot drift apart. */
+#define POISMF_WS_ALIGN ((size_t)64)
+
+static size_t ws_round_up(size_t nbytes)
+{
+    return (nbytes + (POISMF_WS_ALIGN - 1)) & ~(POISMF_WS_ALIGN - 1);
+}
+
+static size_t ws_buffer_elts(size_t k, Method method, int nthreads)
+{
+    size_t size_buffer = 1;
+    switch (method) {
+        case pg:   {size_buffer = 1;  break;}
+        case cg:   {size_buffer = 5;  break;}
+        case tncg: {size_buffer = 22; break;}
     }
+    return size_buffer * k * (size_t)nthreads;
+}
+
+static size_t ws_solver_bytes
+(
+    size_t dimA, size_t dimB, size_t k,
+    Method method, bool weighted, int nthreads
+)
+{
+    size_t nbytes = ws_round_up(k*sizeof(real_t));  /* cnst_sum */
+    nbytes += ws_round_up(ws_buffer_elts(k, method, nthreads)*sizeof(real_t));
+    if (weighted)
+        nbytes += ws_round_up(k*((dimA > dimB)? dimA : dimB)*sizeof(real_t));
+    if (method == tncg) {
+        nbytes += ws_round_up(k*(size_t)nthreads*sizeof(int));
+        nbytes += 2*ws_round_up(k*sizeof(real_t));  /* zeros + inf bounds */
+    }
+    return nbytes;
+}
+
+int poismf_workspace_init
+(
+    poismf_workspace *restrict ws,
+    size_t dimA, size_t dimB, size_t k,
+    Method method, bool weighted, int nthreads
+)
+{
+    memset(ws, 0, sizeof(*ws));
+    ws->size = ws_solver_bytes(dimA, dimB, k, method, weighted, nthreads);
+    ws->slab = malloc(ws->size);
+    if (ws->slab == NULL) {
+        fprintf(stderr, "Error: out of memory.\n");
+        return 1;
+    }
+    ws->dimA = dimA;
+    ws->dimB = dimB;
+    ws->k = k;
+    ws->nthreads = nthreads;
+    ws->method = method;
+    ws->weighted = weighted;
+    return 0;
+}
+
+void poismf_workspace_free(poismf_workspace *restrict ws)
+{
+    free(ws->slab);
+    memset(ws, 0, sizeof(*ws));
+}
+
+/* malloc() guarantees enough alignment on its own; the slab start plus
+   rounded offsets keeps that property for every carved buffer */
+static void* ws_take(poismf_workspace *ws, size_t nbytes)
+{
+    void *out = (char*)ws->slab + ws->used;
+    ws->used += ws_round_up(nbytes);
+    return out;
+}
+
+void poismf_opts_init(poismf_opts *opts)
+{
+    memset(opts, 0, sizeof(*opts));
 }
 
+/* Wall time for the telemetry - outside of OpenMP builds this degrades to
+   process time, which is equivalent there since everything is serial */
+static double poismf_wtime(void)
+{
+    #ifdef _OPENMP
+    return omp_get_wtime();
+    #else
+    return (double)clock() / (double)CLOCKS_PER_SEC;
+    #endif
+}
+
+/*  Asynchronous checkpoint writes: the live factors are copied into a
+    snapshot pair (the double buffer) and a background thread writes those
+    out through 'poismf_checkpoint_save' while training continues on the
+    live matrices. At most one write is in flight; submitting the next
+    snapshot first waits for the previous one. Where threads are not
+    available the write happens synchronously instead. */
+typedef struct poismf_ckpt_writer {
+    const char *path;
+    real_t *A_snap;
+    real_t *B_snap;
+    size_t dimA, dimB, k;
+    uint64_t iter_done;
+    double step_size;
+    bool pending;
+    int err;
+    #ifdef POISMF_HAS_PTHREADS
+    pthread_t thread;
+    #endif
+} poismf_ckpt_writer;
+
+#ifdef POISMF_HAS_PTHREADS
+static void* ckpt_write_routine(void *arg)
+{
+    poismf_ckpt_writer *w = (poismf_ckpt_writer*)arg;
+    w->err = poismf_checkpoint_save(w->path, w->A_snap, w->B_snap,
+                                    w->dimA, w->dimB, w->k,
+                                    w->iter_done, w->step_size);
+    return NULL;
+}
+#endif
+
+static void ckpt_wait(poismf_ckpt_writer *w)
+{
+    #ifdef POISMF_HAS_PTHREADS
+    if (w->pending) {
+        pthread_join(w->thread, NULL);
+        w->pending = false;
+    }
+    #endif
+}
+
+static void ckpt_submit
+(
+    poismf_ckpt_writer *w,
+    real_t *restrict A, real_t *restrict B,
+    uint64_t iter_done, double step_size
+)
+{
+    ckpt_wait(w);
+    memcpy(w->A_snap, A, w->dimA*w->k*sizeof(real_t));
+    memcpy(w->B_snap, B, w->dimB*w->k*sizeof(real_t));
+    w->iter_done = iter_done;
+    w->step_size = step_size;
+    #ifdef POISMF_HAS_PTHREADS
+    if (pthread_create(&w->thread, NULL, ckpt_write_routine, w) == 0) {
+        w->pending = true;
+        return;
+    }
+    #endif
+    w->err = poismf_checkpoint_save(w->path, w->A_snap, w->B_snap,
+                                    w->dimA, w->dimB, w->k,
+                                    w->iter_done, w->step_size);
+}
+
+/* Iteration count already completed before this run - set by
+   'run_poismf_resume' so that checkpoints taken in a resumed run record
+   absolute progress (same pattern as 'should_stop_procedure') */
+static uint64_t ckpt_iter_base = 0;
+
 bool should_stop_procedure = false;
 void set_interrup_global_variable(int s)
 {
@@ -376,52 +1135,164 @@ void set_interrup_global_variable(int s)
     maxupd                    : Number of updates to the same vector per iteration
     handle_interrupt          : Whether to respond to interrupt signals
     nthreads                  : Number of threads to use
+    opts                      : Optional extra settings (may be NULL - see
+                                the 'poismf_opts' struct for the entries)
 Matrices A and B are optimized in-place,
 and are assumed to be in row-major order.
 Returns 0 if it succeeds, 1 if it runs out of memory.
 */
-int run_poismf(
+int run_poismf_ext(
     real_t *restrict A, real_t *restrict Xr, sparse_ix *restrict Xr_indptr, sparse_ix *restrict Xr_indices,
     real_t *restrict B, real_t *restrict Xc, sparse_ix *restrict Xc_indptr, sparse_ix *restrict Xc_indices,
     const size_t dimA, const size_t dimB, const size_t k,
     const real_t l2_reg, const real_t l1_reg, const real_t w_mult, real_t step_size,
     const Method method, const bool limit_step, const size_t numiter, const size_t maxupd,
-    const bool handle_interrupt, const int nthreads)
+    const bool handle_interrupt, const int nthreads,
+    const poismf_opts *restrict opts)
 {
 
-    real_t *cnst_sum = (real_t*) malloc(sizeof(real_t) * k);
     real_t cnst_div;
     int k_int = (int) k;
     real_t neg_step_sz = -step_size;
-    size_t size_buffer = 1;
-    switch(method) {
-        case pg:   {size_buffer = 1;  break;}
-        case cg:   {size_buffer = 5;  break;}
-        case tncg: {size_buffer = 22; break;}
-    }
-    size_buffer *= (k * (size_t)nthreads);
-    real_t *buffer_arr = (real_t*) malloc(sizeof(real_t) * size_buffer);
+    size_t size_buffer = ws_buffer_elts(k, method, nthreads);
+
+    /*  A caller-provided workspace replaces the allocations below; one that
+        is too small for this call's shape (or never initialized) is ignored
+        rather than failed on, so sweeps can size it for their largest
+        configuration and forget about it. */
+    poismf_workspace *ws = (opts != NULL)? opts->workspace : NULL;
+    if (ws != NULL && (ws->slab == NULL ||
+        ws_solver_bytes(dimA, dimB, k, method, w_mult != 1., nthreads)
+            > ws->size))
+        ws = NULL;
+    if (ws != NULL) ws->used = 0;
+
+    real_t *cnst_sum = (ws != NULL)?
+        (real_t*)ws_take(ws, sizeof(real_t) * k) :
+        (real_t*)malloc(sizeof(real_t) * k);
+    real_t *buffer_arr = (ws != NULL)?
+        (real_t*)ws_take(ws, sizeof(real_t) * size_buffer) :
+        (real_t*)malloc(sizeof(real_t) * size_buffer);
     real_t *Bsum_w = NULL;
     int *buffer_int = NULL;
     real_t *zeros_tncg = NULL;
     real_t *inf_tncg = NULL;
+    sparse_ix *order_A = NULL;
+    sparse_ix *order_B = NULL;
+    sparse_ix *csc_map = (opts != NULL)? opts->csc_map : NULL;
+    poismf_stats *stats = (opts != NULL)? opts->stats : NULL;
+    double time_st = 0;
+    real_t *heavy_buffer = NULL;
+    size_t heavy_thresh = (opts != NULL)? opts->heavy_row_nnz : 0;
+    size_t heavy_cap = 0;
+    poismf_ckpt_writer ckpt;
+    size_t ckpt_every = (opts != NULL && opts->checkpoint_path != NULL)?
+                         opts->checkpoint_every : 0;
+    uint64_t ckpt_base = ckpt_iter_base;
+    bool numa_local = (opts != NULL) && opts->numa_local && nthreads > 1;
+    size_t mon_m = (opts != NULL)? opts->monitor_sample : 0;
+    double mon_tol = (opts != NULL)? opts->early_stop_tol : 0.;
+    size_t *mon_pos = NULL;
+    sparse_ix *mon_row = NULL;
+    real_t *mon_sums = NULL;
+    size_t mon_nnz = 0;
+    double mon_prev = 0.;
+    bool mon_has_prev = false;
     int ret_code = 0;
+    memset(&ckpt, 0, sizeof(ckpt));
+    ckpt_iter_base = 0;
     should_stop_procedure = false;
 
+    /* With power-law data, dispatching the heaviest rows first keeps the
+       threads balanced through the tail of the dynamic loops (moot under
+       'numa_local', where rows are bound to fixed thread chunks) */
+    if (opts != NULL && opts->sort_rows_by_nnz && nthreads > 1 && !numa_local) {
+        order_A = build_row_order(Xr_indptr, dimA);
+        order_B = build_row_order(Xc_indptr, dimB);
+        if (order_A == NULL || order_B == NULL) goto throw_oom;
+    }
 
     if (w_mult != 1.) {
-        Bsum_w = (real_t*)malloc(sizeof(real_t) * k * ((dimA > dimB)? dimA : dimB));
+        size_t dim_w = (dimA > dimB)? dimA : dimB;
+        Bsum_w = (ws != NULL)?
+            (real_t*)ws_take(ws, sizeof(real_t) * k * dim_w) :
+            (real_t*)malloc(sizeof(real_t) * k * dim_w);
         if (Bsum_w == NULL) goto throw_oom;
     }
 
+    /*  Stratified sample for the between-iterations log-likelihood monitor:
+        every (nnz/m)-th non-zero in CSR order, which spreads the sample
+        evenly across the rows with no RNG and no extra pass at evaluation
+        time. The row of each sampled entry is resolved here once. */
+    if (mon_m > 0) {
+        mon_nnz = (size_t)Xr_indptr[dimA];
+        mon_m = (mon_m < mon_nnz)? mon_m : mon_nnz;
+        if (mon_m == 0) goto skip_monitor;
+        mon_pos = (size_t*)malloc(mon_m*sizeof(size_t));
+        mon_row = (sparse_ix*)malloc(mon_m*sizeof(sparse_ix));
+        mon_sums = (real_t*)malloc((size_t)2*k*sizeof(real_t));
+        if (mon_pos == NULL || mon_row == NULL || mon_sums == NULL)
+            goto throw_oom;
+        size_t step = mon_nnz / mon_m;
+        size_t row = 0;
+        for (size_t ix = 0; ix < mon_m; ix++) {
+            size_t pos = ix*step + step/2;
+            while ((size_t)Xr_indptr[row + 1] <= pos) row++;
+            mon_pos[ix] = pos;
+            mon_row[ix] = (sparse_ix)row;
+        }
+        skip_monitor: {}
+    }
+
+    if (ckpt_every != 0) {
+        ckpt.path = opts->checkpoint_path;
+        ckpt.dimA = dimA;
+        ckpt.dimB = dimB;
+        ckpt.k = k;
+        ckpt.A_snap = (real_t*)malloc(sizeof(real_t) * dimA * k);
+        ckpt.B_snap = (real_t*)malloc(sizeof(real_t) * dimB * k);
+        if (ckpt.A_snap == NULL || ckpt.B_snap == NULL) goto throw_oom;
+    }
+
     if (method == tncg) {
-        buffer_int = (int*)malloc(sizeof(int) * k *(size_t)nthreads);
-        zeros_tncg = (real_t*)calloc(sizeof(real_t), k);
-        inf_tncg = (real_t*)malloc(sizeof(real_t) * k);
+        if (ws != NULL) {
+            buffer_int = (int*)ws_take(ws, sizeof(int) * k * (size_t)nthreads);
+            zeros_tncg = (real_t*)ws_take(ws, sizeof(real_t) * k);
+            inf_tncg = (real_t*)ws_take(ws, sizeof(real_t) * k);
+            memset(zeros_tncg, 0, k*sizeof(real_t));
+        }
+        else {
+            buffer_int = (int*)malloc(sizeof(int) * k *(size_t)nthreads);
+            zeros_tncg = (real_t*)calloc(sizeof(real_t), k);
+            inf_tncg = (real_t*)malloc(sizeof(real_t) * k);
+        }
         if (buffer_int == NULL || zeros_tncg == NULL || inf_tncg == NULL)
             goto throw_oom;
         for (size_t ix = 0; ix < k; ix++)
             inf_tncg[ix] = HUGE_VAL;
+
+        /* Per-thread panels for the heavy-row path, sized to the largest
+           row that will actually take it (capped so a pathological row
+           cannot blow up the per-thread memory) */
+        if (heavy_thresh > 0) {
+            size_t max_nnz = 0;
+            size_t nnz_this;
+            for (size_t row = 0; row < dimA; row++) {
+                nnz_this = Xr_indptr[row + 1] - Xr_indptr[row];
+                max_nnz = (nnz_this > max_nnz)? nnz_this : max_nnz;
+            }
+            for (size_t row = 0; row < dimB; row++) {
+                nnz_this = Xc_indptr[row + 1] - Xc_indptr[row];
+                max_nnz = (nnz_this > max_nnz)? nnz_this : max_nnz;
+            }
+            heavy_cap = (max_nnz < POISMF_HEAVY_ROW_CAP)?
+                         max_nnz : (size_t)POISMF_HEAVY_ROW_CAP;
+            if (heavy_cap >= heavy_thresh) {
+                heavy_buffer = (real_t*)malloc(sizeof(real_t) * (size_t)nthreads
+                                                * heavy_cap * (k + (size_t)1));
+                if (heavy_buffer == NULL) goto throw_oom;
+            }
+        }
     }
 
     if (buffer_arr == NULL || cnst_sum == NULL)
@@ -432,15 +1303,48 @@ int run_poismf(
             goto cleanup;
     }
 
+    /*  NUMA mode: switch the solver loops to the fixed per-thread row
+        partition (see 'numa_chunk') and first-touch the per-thread slices
+        of the working buffers from their owning threads, so each slice's
+        pages land on the node of the thread that will use them. The factor
+        matrices are caller-allocated - place those rows with
+        'poismf_first_touch' before filling them in. */
+    if (numa_local) {
+        numa_static_rows = true;
+        size_t per_thread = size_buffer / (size_t)nthreads;
+        size_t dim_w = (dimA > dimB)? dimA : dimB;
+        int tid;
+        #pragma omp parallel for schedule(static, 1) num_threads(nthreads) \
+                shared(buffer_arr, buffer_int, Bsum_w, heavy_buffer, \
+                       per_thread, dim_w, k, heavy_cap, nthreads)
+        for (tid = 0; tid < nthreads; tid++)
+        {
+            memset(buffer_arr + (size_t)tid*per_thread, 0,
+                   per_thread*sizeof(real_t));
+            if (buffer_int != NULL)
+                memset(buffer_int + (size_t)tid*k, 0, k*sizeof(int));
+            if (heavy_buffer != NULL)
+                memset(heavy_buffer + (size_t)tid*heavy_cap*(k + (size_t)1),
+                       0, heavy_cap*(k + (size_t)1)*sizeof(real_t));
+            if (Bsum_w != NULL) {
+                size_t row_st, row_end;
+                numa_chunk(dim_w, tid, nthreads, &row_st, &row_end);
+                memset(Bsum_w + row_st*k, 0, (row_end - row_st)*k*sizeof(real_t));
+            }
+        }
+    }
+
     for (size_t fulliter = 0; fulliter < numiter; fulliter++){
 
         if (handle_interrupt)
             signal(SIGINT, set_interrup_global_variable);
         if (should_stop_procedure) goto cleanup;
 
+        if (stats != NULL) time_st = poismf_wtime();
+
         /* Constants to use later */
         cnst_div = 1. / (1. + 2. * l2_reg * step_size);
-        sum_by_cols(cnst_sum, B, dimB, k);
+        sum_by_cols_parallel(cnst_sum, B, dimB, k, nthreads);
         if (l1_reg > 0.)
             for (size_t kk = 0; kk < k; kk++) cnst_sum[kk] += l1_reg;
         if (w_mult != 1.)
@@ -455,40 +1359,44 @@ int run_poismf(
                     cblas_tscal(k_int, neg_step_sz, cnst_sum, 1);
                 else
                     dscal_large(dimA*k, neg_step_sz, Bsum_w);
-                cblas_tscal(k_int, neg_step_sz, cnst_sum, 1);
                 pg_iteration(A, B, Xr, Xr_indptr, Xr_indices,
-                             dimA, k, cnst_div, cnst_sum, Bsum_w, step_size,
-                             w_mult, maxupd, buffer_arr, nthreads);
+                             dimA, k, order_A, NULL, cnst_div, cnst_sum, Bsum_w,
+                             step_size, w_mult, maxupd, buffer_arr, stats, nthreads);
                 break;
             }
 
             case cg:
             {
                 cg_iteration(A, B, Xr, Xr_indptr, Xr_indices,
-                             dimA, k, limit_step, cnst_sum,
+                             dimA, k, order_A, NULL, limit_step, cnst_sum,
                              l2_reg, w_mult, maxupd,
-                             buffer_arr, Bsum_w, nthreads);
+                             buffer_arr, Bsum_w, stats, nthreads);
                 break;
             }
 
             case tncg:
             {
                 tncg_iteration(A, B, Xr, Xr_indptr, Xr_indices,
-                               dimA, k, cnst_sum, l2_reg, w_mult, maxupd,
+                               dimA, k, order_A, NULL, cnst_sum, l2_reg, w_mult, maxupd,
                                buffer_arr, buffer_int,
                                zeros_tncg, inf_tncg,
-                               Bsum_w, nthreads);
+                               Bsum_w,
+                               heavy_buffer, heavy_thresh, heavy_cap,
+                               stats, nthreads);
                 break;
             }
         }
 
+        if (stats != NULL) stats->time_A += poismf_wtime() - time_st;
+
         if (handle_interrupt)
             signal(SIGINT, set_interrup_global_variable);
         if (should_stop_procedure) goto cleanup;
 
+        if (stats != NULL) time_st = poismf_wtime();
 
         /* Same procedure repeated for the B matrix */
-        sum_by_cols(cnst_sum, A, dimA, k);
+        sum_by_cols_parallel(cnst_sum, A, dimA, k, nthreads);
         if (l1_reg > 0.)
             for (size_t kk = 0; kk < k; kk++) cnst_sum[kk] += l1_reg;
         if (w_mult != 1.)
@@ -503,9 +1411,10 @@ int run_poismf(
                     cblas_tscal(k_int, neg_step_sz, cnst_sum, 1);
                 else
                     dscal_large(dimB*k, neg_step_sz, Bsum_w);
-                pg_iteration(B, A, Xc, Xc_indptr, Xc_indices,
-                             dimB, k, cnst_div, cnst_sum, Bsum_w, step_size,
-                             w_mult, maxupd, buffer_arr, nthreads);
+                pg_iteration(B, A, (csc_map == NULL)? Xc : Xr,
+                             Xc_indptr, Xc_indices,
+                             dimB, k, order_B, csc_map, cnst_div, cnst_sum, Bsum_w,
+                             step_size, w_mult, maxupd, buffer_arr, stats, nthreads);
 
                 /* Decrease step size after taking PGD steps in both matrices */
                 step_size *= 0.5;
@@ -515,33 +1424,334 @@ int run_poismf(
 
             case cg:
             {
-                cg_iteration(B, A, Xr, Xc_indptr, Xc_indices,
-                             dimB, k, limit_step, cnst_sum,
+                cg_iteration(B, A, (csc_map == NULL)? Xc : Xr,
+                             Xc_indptr, Xc_indices,
+                             dimB, k, order_B, csc_map, limit_step, cnst_sum,
                              l2_reg, w_mult, maxupd,
-                             buffer_arr, Bsum_w, nthreads);
+                             buffer_arr, Bsum_w, stats, nthreads);
                 break;
             }
 
             case tncg:
             {
-                tncg_iteration(B, A, Xc, Xc_indptr, Xc_indices,
-                               dimB, k, cnst_sum, l2_reg, w_mult, maxupd,
+                tncg_iteration(B, A, (csc_map == NULL)? Xc : Xr,
+                               Xc_indptr, Xc_indices,
+                               dimB, k, order_B, csc_map, cnst_sum, l2_reg, w_mult, maxupd,
                                buffer_arr, buffer_int,
                                zeros_tncg, inf_tncg,
-                               Bsum_w, nthreads);
+                               Bsum_w,
+                               heavy_buffer, heavy_thresh, heavy_cap,
+                               stats, nthreads);
+                break;
+            }
+        }
+
+        if (stats != NULL) {
+            stats->time_B += poismf_wtime() - time_st;
+            stats->iter_done++;
+        }
+
+        if (ckpt_every != 0 && (fulliter + 1) % ckpt_every == 0)
+            ckpt_submit(&ckpt, A, B,
+                        ckpt_base + (uint64_t)(fulliter + 1),
+                        (double)step_size);
+
+        /*  Sampled log-likelihood: the sampled positive term is scaled up
+            to the full non-zero count, and the missing-entries constant
+            comes exactly from the factor column sums (sum of all predictions
+            = <colsums(A), colsums(B)>), which cost far less than the
+            iteration that just ran. Stops once the estimate moves less than
+            the relative tolerance - the point where further iterations are
+            wasted anyway. */
+        if (mon_m > 0)
+        {
+            double lsum = 0.;
+            #if defined(_OPENMP) && ((_OPENMP < 200801) || defined(_WIN32) || defined(_WIN64))
+            long long ix;
+            #else
+            size_t ix;
+            #endif
+            #pragma omp parallel for schedule(static) num_threads(nthreads) \
+                    shared(mon_m, mon_pos, mon_row, Xr, Xr_indices, A, B, k, k_int) \
+                    reduction(+:lsum)
+            for (ix = 0; ix < (long long)mon_m; ix++)
+                lsum += (double)Xr[mon_pos[ix]]
+                         * log(cblas_tdot(k_int,
+                                          A + (size_t)mon_row[ix]*k, 1,
+                                          B + (size_t)Xr_indices[mon_pos[ix]]*k, 1));
+            lsum *= (double)mon_nnz / (double)mon_m;
+            sum_by_cols_parallel(mon_sums, A, dimA, k, nthreads);
+            sum_by_cols_parallel(mon_sums + k, B, dimB, k, nthreads);
+            double llk = lsum - (double)cblas_tdot(k_int, mon_sums, 1,
+                                                   mon_sums + k, 1);
+            if (stats != NULL) stats->monitor_llk = llk;
+            if (mon_has_prev && mon_tol > 0. &&
+                fabs(llk - mon_prev) <= mon_tol * fabs(mon_prev))
+            {
+                if (stats != NULL) stats->early_stopped = 1;
                 break;
             }
+            mon_prev = llk;
+            mon_has_prev = true;
         }
     }
 
     cleanup:
-        free(cnst_sum);
+        if (ws == NULL) {
+            free(cnst_sum);
+            free(buffer_arr);
+            free(buffer_int);
+            free(Bsum_w);
+            free(zeros_tncg);
+            free(inf_tncg);
+        }
+        free(order_A);
+        free(order_B);
+        free(heavy_buffer);
+        ckpt_wait(&ckpt);
+        free(ckpt.A_snap);
+        free(ckpt.B_snap);
+        free(mon_pos);
+        free(mon_row);
+        free(mon_sums);
+        numa_static_rows = false;
+        should_stop_procedure = false;
+
+    return ret_code;
+}
+
+/*  Warm-start refit restricted to the rows of X that changed since the last
+    fit. Only 'changed_rows' (rows of A) and the items they touch (rows of B)
+    are re-optimized; everything else keeps its previous factors. Since rows
+    are solved independently given the other matrix's column sums, this is
+    the same subproblem the full alternation solves - the column sums are
+    kept exact through 'sum_by_cols_delta' instead of being recomputed, so
+    the per-iteration cost scales with the size of the change, not of the
+    model. When nearly all rows are unchanged (the typical nightly refit)
+    this turns a full retrain into a touch-up of the affected rows.
+
+    The X arrays must hold the NEW data in full (both formats, like in
+    'run_poismf'); 'changed_rows' is not modified. Only the cg and tncg
+    methods are supported (pg couples the rows through its step-size
+    schedule), and weights (w_mult != 1) are not supported. Of the extra
+    options, 'stats' and 'sort_rows_by_nnz' are honored; the heavy-row
+    panels are not used here.
+
+    Returns 0 on success, 1 on out-of-memory, 2 on invalid inputs. */
+int run_poismf_incremental(
+    real_t *restrict A, real_t *restrict Xr, sparse_ix *restrict Xr_indptr, sparse_ix *restrict Xr_indices,
+    real_t *restrict B, real_t *restrict Xc, sparse_ix *restrict Xc_indptr, sparse_ix *restrict Xc_indices,
+    const size_t dimA, const size_t dimB, const size_t k,
+    sparse_ix *restrict changed_rows, const size_t n_changed,
+    const real_t l2_reg, const real_t l1_reg,
+    const Method method, const bool limit_step, const size_t numiter, const size_t maxupd,
+    const bool handle_interrupt, const int nthreads,
+    const poismf_opts *restrict opts)
+{
+    if (method != cg && method != tncg) return 2;
+    if (n_changed > dimA) return 2;
+    if (n_changed == 0) return 0;
+
+    size_t size_buffer = ((method == cg)? (size_t)5 : (size_t)22)
+                          * k * (size_t)nthreads;
+    real_t *restrict buffer_arr = (real_t*)malloc(sizeof(real_t) * size_buffer);
+    real_t *restrict cnst_sum = (real_t*)malloc(sizeof(real_t) * k);
+    real_t *restrict csA = (real_t*)malloc(sizeof(real_t) * k);
+    real_t *restrict csB = (real_t*)malloc(sizeof(real_t) * k);
+    sparse_ix *restrict rows_A = (sparse_ix*)malloc(n_changed*sizeof(sparse_ix));
+    sparse_ix *restrict rows_B = NULL;
+    char *restrict touched = (char*)calloc(dimB, sizeof(char));
+    real_t *restrict old_rows = NULL;
+    int *buffer_int = NULL;
+    real_t *zeros_tncg = NULL;
+    real_t *inf_tncg = NULL;
+    sparse_ix *csc_map = (opts != NULL)? opts->csc_map : NULL;
+    poismf_stats *stats = (opts != NULL)? opts->stats : NULL;
+    double time_st = 0;
+    size_t n_cols = 0;
+    int ret_code = 0;
+    should_stop_procedure = false;
+
+    if (buffer_arr == NULL || cnst_sum == NULL || csA == NULL ||
+        csB == NULL || rows_A == NULL || touched == NULL)
+        goto throw_oom;
+    memcpy(rows_A, changed_rows, n_changed*sizeof(sparse_ix));
+
+    /* rows of B to refit: every item touched by a changed row */
+    for (size_t ix = 0; ix < n_changed; ix++) {
+        size_t row = (size_t)changed_rows[ix];
+        for (size_t el = Xr_indptr[row]; el < (size_t)Xr_indptr[row+1]; el++)
+            touched[Xr_indices[el]] = 1;
+    }
+    for (size_t col = 0; col < dimB; col++)
+        n_cols += touched[col];
+    rows_B = (sparse_ix*)malloc(((n_cols == 0)? 1 : n_cols)*sizeof(sparse_ix));
+    if (rows_B == NULL) goto throw_oom;
+    n_cols = 0;
+    for (size_t col = 0; col < dimB; col++)
+        if (touched[col]) rows_B[n_cols++] = (sparse_ix)col;
+
+    if (opts != NULL && opts->sort_rows_by_nnz && nthreads > 1) {
+        ptr_indptr_glob = Xr_indptr;
+        qsort(rows_A, n_changed, sizeof(sparse_ix), cmp_rows_by_nnz);
+        ptr_indptr_glob = Xc_indptr;
+        qsort(rows_B, n_cols, sizeof(sparse_ix), cmp_rows_by_nnz);
+        ptr_indptr_glob = NULL;
+    }
+
+    old_rows = (real_t*)malloc(sizeof(real_t) * k *
+                               ((n_changed > n_cols)? n_changed : n_cols));
+    if (old_rows == NULL) goto throw_oom;
+
+    if (method == tncg) {
+        buffer_int = (int*)malloc(sizeof(int) * k * (size_t)nthreads);
+        zeros_tncg = (real_t*)calloc(sizeof(real_t), k);
+        inf_tncg = (real_t*)malloc(sizeof(real_t) * k);
+        if (buffer_int == NULL || zeros_tncg == NULL || inf_tncg == NULL)
+            goto throw_oom;
+        for (size_t ix = 0; ix < k; ix++)
+            inf_tncg[ix] = HUGE_VAL;
+    }
+
+    /* full column sums once up front - afterwards only deltas */
+    sum_by_cols_parallel(csA, A, dimA, k, nthreads);
+    sum_by_cols_parallel(csB, B, dimB, k, nthreads);
+
+    for (size_t fulliter = 0; fulliter < numiter; fulliter++) {
+
+        if (handle_interrupt)
+            signal(SIGINT, set_interrup_global_variable);
+        if (should_stop_procedure) goto cleanup;
+
+        if (stats != NULL) time_st = poismf_wtime();
+
+        memcpy(cnst_sum, csB, k*sizeof(real_t));
+        if (l1_reg > 0.)
+            for (size_t kk = 0; kk < k; kk++) cnst_sum[kk] += l1_reg;
+        for (size_t ix = 0; ix < n_changed; ix++)
+            memcpy(old_rows + ix*k, A + (size_t)rows_A[ix]*k,
+                   k*sizeof(real_t));
+        if (method == cg)
+            cg_iteration(A, B, Xr, Xr_indptr, Xr_indices,
+                         n_changed, k, rows_A, NULL, limit_step, cnst_sum,
+                         l2_reg, 1., maxupd,
+                         buffer_arr, NULL, stats, nthreads);
+        else
+            tncg_iteration(A, B, Xr, Xr_indptr, Xr_indices,
+                           n_changed, k, rows_A, NULL, cnst_sum, l2_reg, 1., maxupd,
+                           buffer_arr, buffer_int,
+                           zeros_tncg, inf_tncg,
+                           NULL, NULL, 0, 0,
+                           stats, nthreads);
+        sum_by_cols_delta(csA, A, old_rows, rows_A, n_changed, k);
+
+        if (stats != NULL) stats->time_A += poismf_wtime() - time_st;
+
+        if (handle_interrupt)
+            signal(SIGINT, set_interrup_global_variable);
+        if (should_stop_procedure) goto cleanup;
+
+        if (stats != NULL) time_st = poismf_wtime();
+
+        memcpy(cnst_sum, csA, k*sizeof(real_t));
+        if (l1_reg > 0.)
+            for (size_t kk = 0; kk < k; kk++) cnst_sum[kk] += l1_reg;
+        for (size_t ix = 0; ix < n_cols; ix++)
+            memcpy(old_rows + ix*k, B + (size_t)rows_B[ix]*k,
+                   k*sizeof(real_t));
+        if (method == cg)
+            cg_iteration(B, A, (csc_map == NULL)? Xc : Xr,
+                         Xc_indptr, Xc_indices,
+                         n_cols, k, rows_B, csc_map, limit_step, cnst_sum,
+                         l2_reg, 1., maxupd,
+                         buffer_arr, NULL, stats, nthreads);
+        else
+            tncg_iteration(B, A, (csc_map == NULL)? Xc : Xr,
+                           Xc_indptr, Xc_indices,
+                           n_cols, k, rows_B, csc_map, cnst_sum, l2_reg, 1., maxupd,
+                           buffer_arr, buffer_int,
+                           zeros_tncg, inf_tncg,
+                           NULL, NULL, 0, 0,
+                           stats, nthreads);
+        sum_by_cols_delta(csB, B, old_rows, rows_B, n_cols, k);
+
+        if (stats != NULL) {
+            stats->time_B += poismf_wtime() - time_st;
+            stats->iter_done++;
+        }
+    }
+
+    goto cleanup;
+    throw_oom:
+        fprintf(stderr, "Error: out of memory.\n");
+        ret_code = 1;
+    cleanup:
         free(buffer_arr);
+        free(cnst_sum);
+        free(csA);
+        free(csB);
+        free(rows_A);
+        free(rows_B);
+        free(touched);
+        free(old_rows);
         free(buffer_int);
-        free(Bsum_w);
         free(zeros_tncg);
         free(inf_tncg);
         should_stop_procedure = false;
 
     return ret_code;
 }
+
+/* Same as above, with the default settings for the extra options */
+int run_poismf(
+    real_t *restrict A, real_t *restrict Xr, sparse_ix *restrict Xr_indptr, sparse_ix *restrict Xr_indices,
+    real_t *restrict B, real_t *restrict Xc, sparse_ix *restrict Xc_indptr, sparse_ix *restrict Xc_indices,
+    const size_t dimA, const size_t dimB, const size_t k,
+    const real_t l2_reg, const real_t l1_reg, const real_t w_mult, real_t step_size,
+    const Method method, const bool limit_step, const size_t numiter, const size_t maxupd,
+    const bool handle_interrupt, const int nthreads)
+{
+    return run_poismf_ext(A, Xr, Xr_indptr, Xr_indices,
+                          B, Xc, Xc_indptr, Xc_indices,
+                          dimA, dimB, k,
+                          l2_reg, l1_reg, w_mult, step_size,
+                          method, limit_step, numiter, maxupd,
+                          handle_interrupt, nthreads,
+                          (poismf_opts*)NULL);
+}
+
+/*  Restarts a checkpointed run. Loads the factors and the recorded progress
+    from 'checkpoint_path' into the caller-allocated 'A' and 'B' and runs the
+    remaining iterations ('numiter' is the TOTAL for the run, so resuming at
+    iteration 8 of 10 runs 2 more). For pg, the step size continues from the
+    recorded value rather than the initial one. Checkpoints taken by the
+    resumed run (through 'opts') record absolute iteration numbers, so a run
+    can be preempted and resumed any number of times.
+    Returns like 'run_poismf_ext', plus 2 if the checkpoint is invalid or
+    its dimensions do not match. */
+int run_poismf_resume(
+    const char *checkpoint_path,
+    real_t *restrict A, real_t *restrict Xr, sparse_ix *restrict Xr_indptr, sparse_ix *restrict Xr_indices,
+    real_t *restrict B, real_t *restrict Xc, sparse_ix *restrict Xc_indptr, sparse_ix *restrict Xc_indices,
+    const size_t dimA, const size_t dimB, const size_t k,
+    const real_t l2_reg, const real_t l1_reg, const real_t w_mult,
+    const Method method, const bool limit_step, const size_t numiter, const size_t maxupd,
+    const bool handle_interrupt, const int nthreads,
+    const poismf_opts *restrict opts)
+{
+    uint64_t iter_done = 0;
+    double step_size = 0.;
+    int retval = poismf_checkpoint_load(checkpoint_path, A, B,
+                                        dimA, dimB, k,
+                                        &iter_done, &step_size);
+    if (retval != 0) return retval;
+    if ((size_t)iter_done >= numiter) return 0;
+
+    ckpt_iter_base = iter_done;
+    return run_poismf_ext(A, Xr, Xr_indptr, Xr_indices,
+                          B, Xc, Xc_indptr, Xc_indices,
+                          dimA, dimB, k,
+                          l2_reg, l1_reg, w_mult, (real_t)step_size,
+                          method, limit_step, numiter - (size_t)iter_done,
+                          maxupd, handle_interrupt, nthreads, opts);
+}
@@ -37,6 +37,9 @@
     OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#ifndef POISMF_H
+#define POISMF_H
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -59,6 +62,7 @@ extern "C" {
 
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <math.h>
 #include <stdlib.h>
@@ -72,7 +76,18 @@ extern "C" {
     #define omp_get_thread_num() (0)
 #endif
 #ifndef _FOR_R
-    #define sparse_ix size_t
+    /*  POISMF_IX32 swaps the sparse indices to 32-bit, halving the memory
+        spent on 'Xr_indices'/'Xc_indices' when the dimensions allow it.
+        Note that the 'indptr' arrays then also become 32-bit, so a single
+        matrix is limited to UINT32_MAX non-zeros - larger data can be split
+        with the out-of-core shards, which are bounded per-file. A 32-bit
+        copy of the library can also be linked next to the default one (see
+        poismf_ix32.c and the '_ix32' declarations at the bottom). */
+    #ifdef POISMF_IX32
+        #define sparse_ix uint32_t
+    #else
+        #define sparse_ix size_t
+    #endif
     #include <stdio.h>
 #else
     #include <Rinternals.h>
@@ -93,6 +108,7 @@ extern "C" {
     #define cblas_tscal cblas_dscal
     #define cblas_tnrm2 cblas_dnrm2
     #define cblas_tgemv cblas_dgemv
+    #define cblas_tgemm cblas_dgemm
 #else
     #ifndef real_t
         #define real_t float
@@ -102,6 +118,7 @@ extern "C" {
     #define cblas_tscal cblas_sscal
     #define cblas_tnrm2 cblas_snrm2
     #define cblas_tgemv cblas_sgemv
+    #define cblas_tgemm cblas_sgemm
 #endif
 
 /* https://www.github.com/david-cortes/nonneg_cg */
@@ -119,10 +136,20 @@ typedef struct fdata {
     real_t *Bsum;
     real_t *Xr;
     sparse_ix *X_ind;
+    sparse_ix *X_map;  /* optional: positions of the values inside 'Xr' */
     sparse_ix nnz_this;
     real_t l2_reg;
     real_t w_mult;
     int k;
+    /* optional dense-panel path for heavy rows (see 'tncg_iteration'):
+       when 'Bpanel' is set, it holds the B rows of this row's non-zeros
+       gathered contiguously, and evaluations go through GEMV over it */
+    real_t *Bpanel;
+    real_t *pred_buffer;
+    /* optional interleaved copy of B (see 'poismf_pack_B'): when set,
+       evaluations read it through the packed kernels instead of doing
+       one random row gather per non-zero */
+    real_t *B_pack;
 } fdata;
 
 /* TNC */
@@ -144,6 +171,10 @@ typedef struct fdata {
     real_t cblas_tnrm2(const int n, const real_t *x, const int incx);
     void cblas_tgemv(const CBLAS_ORDER order,  const CBLAS_TRANSPOSE TransA,  const int m, const int n,
          const real_t alpha, const real_t  *a, const int lda,  const real_t  *x, const int incx,  const real_t beta,  real_t  *y, const int incy);
+    void cblas_tgemm(const CBLAS_ORDER Order, const CBLAS_TRANSPOSE TransA, const CBLAS_TRANSPOSE TransB,
+         const int M, const int N, const int K,
+         const real_t alpha, const real_t *A, const int lda, const real_t *B, const int ldb,
+         const real_t beta, real_t *C, const int ldc);
     #endif
 #endif
 
@@ -162,9 +193,84 @@ typedef struct fdata {
 
 /* Function prototypes */
 
+/* simd_kernels.c */
+real_t fused_fun
+(
+    real_t *restrict a_row, real_t *restrict B,
+    real_t *restrict Xr, sparse_ix *restrict X_ind,
+    sparse_ix *restrict X_map,
+    size_t nnz, int k
+);
+void fused_grad
+(
+    real_t *restrict a_row, real_t *restrict B,
+    real_t *restrict Xr, sparse_ix *restrict X_ind,
+    sparse_ix *restrict X_map,
+    size_t nnz, int k,
+    real_t mult, real_t *restrict grad
+);
+real_t fused_fun_grad
+(
+    real_t *restrict a_row, real_t *restrict B,
+    real_t *restrict Xr, sparse_ix *restrict X_ind,
+    sparse_ix *restrict X_map,
+    size_t nnz, int k,
+    real_t *restrict grad
+);
+/*  Blocked-interleaved copy of a factor matrix: rows are grouped in blocks
+    of 'POISMF_PACK_WIDTH' and their entries interleaved lane-wise within
+    each block (entry j of row 'g*W + l' lives at 'pack[g*W*k + j*W + l]').
+    The packed kernels below read whole blocks sequentially, so non-zeros
+    whose indices fall in the same block share one streamed panel instead
+    of doing a random gather each. 'B_pack' must have room for
+    '((dimB + W - 1) / W) * W * k' entries; the padding lanes of the last
+    block are zeroed. */
+#define POISMF_PACK_WIDTH 8
+void poismf_pack_B(real_t *restrict B, size_t dimB, size_t k, real_t *restrict B_pack);
+/*  Vectorized natural log over an array ('out' must not alias 'x'). The
+    log-heavy accumulations work on strips of 'POISMF_LOG_STRIP' predictions
+    at a time so they go through this instead of one libm call per non-zero. */
+#define POISMF_LOG_STRIP 256
+void poismf_vlog(const real_t *restrict x, real_t *restrict out, size_t n);
+real_t fused_fun_packed
+(
+    real_t *restrict a_row, real_t *restrict B_pack,
+    real_t *restrict Xr, sparse_ix *restrict X_ind,
+    sparse_ix *restrict X_map,
+    size_t nnz, int k
+);
+void fused_grad_packed
+(
+    real_t *restrict a_row, real_t *restrict B_pack,
+    real_t *restrict Xr, sparse_ix *restrict X_ind,
+    sparse_ix *restrict X_map,
+    size_t nnz, int k,
+    real_t mult, real_t *restrict grad
+);
+real_t fused_fun_grad_packed
+(
+    real_t *restrict a_row, real_t *restrict B_pack,
+    real_t *restrict Xr, sparse_ix *restrict X_ind,
+    sparse_ix *restrict X_map,
+    size_t nnz, int k,
+    real_t *restrict grad
+);
+
 /* poismf.c */
+typedef struct poismf_stats poismf_stats; /* defined below */
 void dscal_large(size_t n, real_t alpha, real_t *restrict x);
 void sum_by_cols(real_t *restrict out, real_t *restrict M, size_t nrow, size_t ncol);
+void sum_by_cols_parallel
+(
+    real_t *restrict out, real_t *restrict M,
+    size_t nrow, size_t ncol, int nthreads
+);
+void sum_by_cols_delta
+(
+    real_t *restrict out,
+    real_t *restrict M, real_t *restrict M_old,
+    sparse_ix *restrict rows, size_t n_rows, size_t ncol
+);
 void adjustment_Bsum
 (
     real_t *restrict B,
@@ -175,15 +281,23 @@ void adjustment_Bsum
     size_t dimA, size_t k,
     real_t w_mult, int nthreads
 );
-void calc_grad_pgd(real_t *out, real_t *curr, real_t *F, real_t *X, sparse_ix *Xind, sparse_ix nnz_this, int k);
+void calc_grad_pgd(real_t *out, real_t *curr, real_t *F, real_t *X, sparse_ix *Xind, sparse_ix *Xmap, sparse_ix nnz_this, int k);
+void poismf_first_touch(real_t *restrict M, size_t nrow, size_t ncol, int nthreads);
+int poismf_build_csc_map
+(
+    sparse_ix *restrict Xr_indptr, sparse_ix *restrict Xr_indices,
+    size_t dimA, size_t dimB,
+    sparse_ix *restrict Xc_indptr, sparse_ix *restrict Xc_indices,
+    sparse_ix *restrict csc_map
+);
 void pg_iteration
 (
     real_t *A, real_t *B,
     real_t *Xr, sparse_ix *Xr_indptr, sparse_ix *Xr_indices,
-    size_t dimA, size_t k,
+    size_t dimA, size_t k, sparse_ix *row_order, sparse_ix *Xr_map,
     real_t cnst_div, real_t *cnst_sum, real_t *Bsum_user,
     real_t step_size, real_t w_mult, size_t maxupd,
-    real_t *buffer_arr, int nthreads
+    real_t *buffer_arr, poismf_stats *stats, int nthreads
 );
 void calc_fun_single(real_t a_row[], int k_int, real_t *f, void *data);
 void calc_grad_single(real_t a_row[], int k_int, real_t grad[], void *data);
@@ -199,24 +313,111 @@ void cg_iteration
 (
     real_t *A, real_t *B,
     real_t *Xr, sparse_ix *Xr_indptr, sparse_ix *Xr_indices,
-    size_t dimA, size_t k, bool limit_step,
+    size_t dimA, size_t k, sparse_ix *row_order, sparse_ix *Xr_map, bool limit_step,
     real_t *Bsum, real_t l2_reg, real_t w_mult, size_t maxupd,
-    real_t *buffer_arr, real_t *Bsum_w, int nthreads
+    real_t *buffer_arr, real_t *Bsum_w, poismf_stats *stats, int nthreads
 );
 void tncg_iteration
 (
     real_t *A, real_t *B,
     real_t *Xr, sparse_ix *Xr_indptr, sparse_ix *Xr_indices,
-    size_t dimA, size_t k,
+    size_t dimA, size_t k, sparse_ix *row_order, sparse_ix *Xr_map,
     real_t *Bsum, real_t l2_reg, real_t w_mult, int maxupd,
     real_t *buffer_arr, int *buffer_int,
     real_t *zeros_tncg, real_t *inf_tncg,
-    real_t *Bsum_w, int nthreads
+    real_t *Bsum_w,
+    real_t *heavy_buffer, size_t heavy_thresh, size_t heavy_cap,
+    poismf_stats *stats, int nthreads
 );
 void set_interrup_global_variable(int s);
 
 /* main function */
 typedef enum Method {tncg = 1, cg = 2, pg = 3} Method;
+/*  Optional training telemetry - initialize with 'poismf_stats_init' and pass
+    through 'opts->stats'. Counters are accumulated with per-thread partials
+    that get folded in at the end of each half-iteration, so the struct can
+    be read concurrently from another thread for live monitoring (values are
+    then at most one phase behind). Histogram bin 'b' counts rows whose value
+    fell in [2^(b-1), 2^b), with bin zero counting exact zeros and the last
+    bin catching everything above. The flop estimate only counts the
+    objective/gradient evaluations (roughly 4*k flops per non-zero per
+    evaluation), which is where the time goes. */
+#define POISMF_STATS_BINS 16
+struct poismf_stats {
+    size_t iter_done;           /* full alternating iterations completed */
+    double time_A;              /* cumulative seconds spent on the A phases */
+    double time_B;              /* cumulative seconds spent on the B phases */
+    uint64_t rows_solved;
+    uint64_t rows_skipped;      /* rows with no non-zeros */
+    uint64_t rows_hit_maxupd;   /* rows stopped by 'maxupd', not by tolerance */
+    uint64_t hist_nfeval[POISMF_STATS_BINS];
+    uint64_t hist_niter[POISMF_STATS_BINS];
+    double flops_est;
+    double monitor_llk;         /* last sampled log-likelihood (see
+                                   'monitor_sample' in the options) */
+    uint64_t early_stopped;     /* 1 when the run ended on the plateau check */
+};
+void poismf_stats_init(poismf_stats *stats);
+/*  Reusable solver workspace. 'run_poismf_ext' carves its per-call buffers
+    (the per-thread scratch, the column-sum vector, the weighted Bsum copies
+    and the tncg bound arrays) from separate allocations on every call;
+    callers running repeated fits over the same shape - hyperparameter
+    sweeps, scheduled retrains - can instead size this arena once and pass
+    it through 'opts->workspace' so every fit reuses the same cache-line-
+    aligned slab, paying the allocation and page-fault cost only once.
+    'weighted' must be true when fits will use w_mult != 1. A workspace
+    sized for tncg also covers cg and pg at the same dimensions; if a call
+    needs more than the arena holds, it silently falls back to its own
+    allocations. Not valid for concurrent fits from multiple threads. */
+typedef struct poismf_workspace {
+    void *slab;
+    size_t size;
+    size_t used;       /* bump cursor, reset at the start of each fit */
+    size_t dimA, dimB, k;
+    int nthreads;
+    Method method;
+    bool weighted;
+} poismf_workspace;
+int poismf_workspace_init
+(
+    poismf_workspace *restrict ws,
+    size_t dimA, size_t dimB, size_t k,
+    Method method, bool weighted, int nthreads
+);
+void poismf_workspace_free(poismf_workspace *restrict ws);
+/* Extra options for 'run_poismf_ext' - initialize with 'poismf_opts_init'
+   to get the default behavior, then set what's needed */
+typedef struct poismf_opts {
+    bool sort_rows_by_nnz;  /* dispatch heaviest rows to the threads first */
+    sparse_ix *csc_map;     /* when set, 'Xc' may be NULL and the column-sparse
+                               values are read from 'Xr' through this map
+                               (see 'poismf_build_csc_map') */
+    size_t heavy_row_nnz;   /* tncg only: rows with at least this many non-zeros
+                               get their B rows gathered into a dense panel which
+                               the solver then evaluates through GEMV
+                               (0 = disabled) */
+    poismf_stats *stats;    /* when set, training telemetry is collected here */
+    const char *checkpoint_path;  /* when set together with 'checkpoint_every',
+                                     training snapshots A and B to this file at
+                                     iteration boundaries (see 'run_poismf_resume') */
+    size_t checkpoint_every;      /* snapshot every this many full iterations
+                                     (0 = no checkpointing) */
+    bool numa_local;        /* multi-socket mode: bind rows to fixed per-thread
+                               chunks and first-touch the working buffers from
+                               their owning threads (pin threads and place A/B
+                               with 'poismf_first_touch' to get the benefit) */
+    size_t monitor_sample;  /* when non-zero, a stratified sample of this many
+                               non-zeros is scored after each iteration for a
+                               cheap log-likelihood estimate (readable through
+                               'stats->monitor_llk') */
+    double early_stop_tol;  /* with the monitor on, stop once the sampled
+                               log-likelihood changes by less than this
+                               relative tolerance between iterations
+                               (0 = monitor only, never stop early) */
+    poismf_workspace *workspace;  /* preallocated solver buffers, reusable
+                                     across calls (see 'poismf_workspace') */
+} poismf_opts;
+void poismf_opts_init(poismf_opts *opts);
 int run_poismf(
     real_t *restrict A, real_t *restrict Xr, sparse_ix *restrict Xr_indptr, sparse_ix *restrict Xr_indices,
     real_t *restrict B, real_t *restrict Xc, sparse_ix *restrict Xc_indptr, sparse_ix *restrict Xc_indices,
@@ -224,8 +425,27 @@ int run_poismf(
     const real_t l2_reg, const real_t l1_reg, const real_t w_mult, real_t step_size,
     const Method method, const bool limit_step, const size_t numiter, const size_t maxupd,
     const bool handle_interrupt, const int nthreads);
+int run_poismf_ext(
+    real_t *restrict A, real_t *restrict Xr, sparse_ix *restrict Xr_indptr, sparse_ix *restrict Xr_indices,
+    real_t *restrict B, real_t *restrict Xc, sparse_ix *restrict Xc_indptr, sparse_ix *restrict Xc_indices,
+    const size_t dimA, const size_t dimB, const size_t k,
+    const real_t l2_reg, const real_t l1_reg, const real_t w_mult, real_t step_size,
+    const Method method, const bool limit_step, const size_t numiter, const size_t maxupd,
+    const bool handle_interrupt, const int nthreads,
+    const poismf_opts *restrict opts);
+int run_poismf_incremental(
+    real_t *restrict A, real_t *restrict Xr, sparse_ix *restrict Xr_indptr, sparse_ix *restrict Xr_indices,
+    real_t *restrict B, real_t *restrict Xc, sparse_ix *restrict Xc_indptr, sparse_ix *restrict Xc_indices,
+    const size_t dimA, const size_t dimB, const size_t k,
+    sparse_ix *restrict changed_rows, const size_t n_changed,
+    const real_t l2_reg, const real_t l1_reg,
+    const Method method, const bool limit_step, const size_t numiter, const size_t maxupd,
+    const bool handle_interrupt, const int nthreads,
+    const poismf_opts *restrict opts);
 
 /* topN.c */
+extern real_t *ptr_real_t_glob;
+#pragma omp threadprivate(ptr_real_t_glob)
 bool check_is_sorted(sparse_ix arr[], size_t n);
 void qs_argpartition(sparse_ix arr[], real_t values[], size_t n, size_t k);
 int cmp_size_t(const void *a, const void *b);
@@ -238,6 +458,201 @@ int topN
     sparse_ix *restrict outp_ix, real_t *restrict outp_score,
     size_t n_top, size_t n, int nthreads
 );
+int topN_multiple
+(
+    real_t *restrict A, size_t dimA, real_t *restrict B, int k,
+    sparse_ix *restrict outp_ix, real_t *restrict outp_score,
+    size_t n_top, size_t n, int nthreads
+);
+typedef struct poismf_exclude_set {
+    size_t n;           /* number of items the set covers */
+    size_t n_exclude;   /* number of distinct items added */
+    uint64_t *bits;
+} poismf_exclude_set;
+int poismf_exclude_set_init(poismf_exclude_set *restrict set, size_t n);
+void poismf_exclude_set_add(poismf_exclude_set *restrict set, sparse_ix ix);
+void poismf_exclude_set_from_row
+(
+    poismf_exclude_set *restrict set,
+    sparse_ix X_ind[], size_t nnz
+);
+void poismf_exclude_set_free(poismf_exclude_set *restrict set);
+int topN_excl
+(
+    real_t *restrict a_vec, real_t *restrict B, int k,
+    const poismf_exclude_set *restrict excl,
+    sparse_ix *restrict outp_ix, real_t *restrict outp_score,
+    size_t n_top, size_t n
+);
+
+/* mips.c */
+typedef struct poismf_mips_index {
+    size_t n;
+    size_t k;
+    size_t block_size;
+    size_t n_blocks;
+    sparse_ix *item_order;  /* sorted position -> original item id */
+    real_t *B_sorted;       /* item factors gathered in that order */
+    real_t *block_max;      /* elementwise maxima per block (upper bounds) */
+} poismf_mips_index;
+int poismf_mips_index_build
+(
+    poismf_mips_index *restrict index,
+    real_t *restrict B, size_t n, size_t k,
+    size_t block_size
+);
+void poismf_mips_index_free(poismf_mips_index *restrict index);
+int topN_approx
+(
+    real_t *restrict a_vec,
+    poismf_mips_index *restrict index,
+    sparse_ix *restrict exclude_ix, size_t n_exclude,
+    sparse_ix *restrict outp_ix, real_t *restrict outp_score,
+    size_t n_top, real_t prune_mult
+);
+
+/* serialize.c */
+typedef struct poismf_model_header {
+    char magic[8];
+    uint32_t fmt_version;
+    uint32_t real_width;
+    uint64_t dimA;
+    uint64_t dimB;
+    uint64_t k;
+    uint64_t off_A;  /* byte offset of the A matrix, page-aligned */
+    uint64_t off_B;  /* byte offset of the B matrix, page-aligned */
+} poismf_model_header;
+typedef struct poismf_mmap_model {
+    real_t *A;
+    real_t *B;
+    size_t dimA;
+    size_t dimB;
+    size_t k;
+    void *mem;        /* the whole mapping (or allocation, without mmap) */
+    size_t mem_size;
+    bool owned;       /* true when 'mem' was malloc'd rather than mapped */
+} poismf_mmap_model;
+int poismf_save
+(
+    const char *path,
+    real_t *restrict A, real_t *restrict B,
+    size_t dimA, size_t dimB, size_t k
+);
+int poismf_mmap_load(const char *path, poismf_mmap_model *restrict out);
+void poismf_mmap_unload(poismf_mmap_model *restrict out);
+typedef struct poismf_checkpoint_footer {
+    char magic[8];
+    uint64_t iter_done;  /* full iterations completed at snapshot time */
+    double step_size;    /* current pg step size (ignored by cg/tncg) */
+} poismf_checkpoint_footer;
+int poismf_checkpoint_save
+(
+    const char *path,
+    real_t *restrict A, real_t *restrict B,
+    size_t dimA, size_t dimB, size_t k,
+    uint64_t iter_done, double step_size
+);
+int poismf_checkpoint_load
+(
+    const char *path,
+    real_t *restrict A, real_t *restrict B,
+    size_t dimA, size_t dimB, size_t k,
+    uint64_t *restrict iter_done, double *restrict step_size
+);
+int run_poismf_resume(
+    const char *checkpoint_path,
+    real_t *restrict A, real_t *restrict Xr, sparse_ix *restrict Xr_indptr, sparse_ix *restrict Xr_indices,
+    real_t *restrict B, real_t *restrict Xc, sparse_ix *restrict Xc_indptr, sparse_ix *restrict Xc_indices,
+    const size_t dimA, const size_t dimB, const size_t k,
+    const real_t l2_reg, const real_t l1_reg, const real_t w_mult,
+    const Method method, const bool limit_step, const size_t numiter, const size_t maxupd,
+    const bool handle_interrupt, const int nthreads,
+    const poismf_opts *restrict opts);
+
+/*  poismf_cuda.cu - optional GPU backend, not part of the regular builds.
+    Only available when that file is compiled separately with nvcc/hipcc
+    and POISMF_CUDA defined (see the comment at its top). Supports methods
+    'pg' and 'cg' with 'w_mult' fixed at 1; A, B and both sparse views
+    stay device-resident across all 'numiter' iterations, with factors
+    copied back only at checkpoints ('opts->checkpoint_path' /
+    'opts->checkpoint_every') and at the end. */
+#if defined(POISMF_CUDA)
+int run_poismf_cuda
+(
+    real_t *restrict A, real_t *restrict Xr,
+    sparse_ix *restrict Xr_indptr, sparse_ix *restrict Xr_indices,
+    real_t *restrict B, real_t *restrict Xc,
+    sparse_ix *restrict Xc_indptr, sparse_ix *restrict Xc_indices,
+    const size_t dimA, const size_t dimB, const size_t k,
+    const real_t l2_reg, const real_t l1_reg, real_t step_size,
+    const Method method, const bool limit_step,
+    const size_t numiter, const size_t maxupd,
+    const poismf_opts *restrict opts
+);
+#endif
+
+/*  poismf_mpi.c - multi-node distributed driver, not part of the regular
+    builds. Only available when that file is compiled separately with the
+    MPI compiler wrapper and POISMF_MPI defined (see the comment at its
+    top). Each rank owns contiguous row ranges of A and B plus the
+    matching CSR/CSC data slices; factor panels and column sums are
+    exchanged between phases. Unweighted fits only, like the out-of-core
+    driver. */
+#if defined(POISMF_MPI)
+#include <mpi.h>
+int run_poismf_mpi(
+    MPI_Comm comm,
+    real_t *restrict A, real_t *restrict Xr, sparse_ix *restrict Xr_indptr, sparse_ix *restrict Xr_indices,
+    real_t *restrict B, real_t *restrict Xc, sparse_ix *restrict Xc_indptr, sparse_ix *restrict Xc_indices,
+    const size_t dimA, const size_t dimB, const size_t k,
+    const size_t row_stA, const size_t dimA_loc,
+    const size_t row_stB, const size_t dimB_loc,
+    const real_t l2_reg, const real_t l1_reg, real_t step_size,
+    const Method method, const bool limit_step, const size_t numiter, const size_t maxupd,
+    const bool handle_interrupt, const int nthreads);
+#endif
+
+/* ooc.c */
+typedef struct poismf_shard_header {
+    char magic[8];
+    uint32_t fmt_version;
+    uint32_t real_width;
+    uint32_t ix_width;     /* sizeof(sparse_ix) of the writing build */
+    uint32_t unused;
+    uint64_t row_st;
+    uint64_t row_end;
+    uint64_t nnz;
+    uint64_t off_indptr;   /* byte offsets of the sections, page-aligned */
+    uint64_t off_indices;
+    uint64_t off_values;
+} poismf_shard_header;
+typedef struct poismf_csr_shard {
+    real_t *Xr;
+    sparse_ix *Xr_indptr;  /* rebased: first entry is zero */
+    sparse_ix *Xr_indices;
+    size_t row_st;
+    size_t row_end;
+    size_t nnz;
+    void *mem;        /* the whole mapping (or allocation, without mmap) */
+    size_t mem_size;
+    bool owned;       /* true when 'mem' was malloc'd rather than mapped */
+} poismf_csr_shard;
+int poismf_shard_save
+(
+    const char *path,
+    real_t *restrict Xr, sparse_ix *restrict Xr_indptr,
+    sparse_ix *restrict Xr_indices,
+    size_t row_st, size_t row_end
+);
+int poismf_shard_open(const char *path, poismf_csr_shard *restrict out);
+void poismf_shard_close(poismf_csr_shard *restrict out);
+int run_poismf_ooc(
+    real_t *restrict A, const char **row_shards, size_t n_row_shards,
+    real_t *restrict B, const char **col_shards, size_t n_col_shards,
+    const size_t dimA, const size_t dimB, const size_t k,
+    const real_t l2_reg, const real_t l1_reg, real_t step_size,
+    const Method method, const bool limit_step, const size_t numiter, const size_t maxupd,
+    const bool handle_interrupt, const int nthreads);
 
 /* llk_and_pred.c */
 void predict_multiple
@@ -248,6 +663,14 @@ void predict_multiple
     size_t n, int k,
     int nthreads
 );
+void predict_csr
+(
+    real_t *restrict out,
+    real_t *restrict A, real_t *restrict B,
+    sparse_ix *restrict Xr_indptr, sparse_ix *restrict Xr_indices,
+    size_t dimA, int k,
+    int nthreads
+);
 long double eval_llk
 (
     real_t *restrict A,
@@ -270,6 +693,34 @@ int factors_multiple
     Method method, bool limit_step,
     int nthreads
 );
+typedef struct poismf_foldin_ctx {
+    size_t k;
+    real_t *B;          /* not owned */
+    real_t *Bsum;       /* cached copy (should include the old l1 reg.) */
+    real_t *a_mean;     /* cached column means of the old A (warm start) */
+    real_t *Bsum_pass;
+    real_t *zeros_tncg;
+    real_t *inf_tncg;
+    real_t *buffer_arr;
+    int *buffer_int;
+    real_t *B_pack;     /* optional interleaved copy of B (owned) */
+} poismf_foldin_ctx;
+int poismf_foldin_ctx_init
+(
+    poismf_foldin_ctx *restrict ctx,
+    real_t *restrict B, real_t *restrict Bsum,
+    real_t *restrict A_old, size_t dimA, size_t dimB,
+    size_t k, bool pack_B
+);
+void poismf_foldin_ctx_free(poismf_foldin_ctx *restrict ctx);
+int factors_single_ctx
+(
+    real_t *restrict out,
+    poismf_foldin_ctx *restrict ctx,
+    real_t *restrict X, sparse_ix X_ind[], size_t nnz,
+    int maxupd, real_t l2_reg, real_t l1_new, real_t l1_old,
+    real_t w_mult
+);
 int factors_single
 (
     real_t *restrict out, size_t k,
@@ -279,8 +730,247 @@ int factors_single
     int maxupd, real_t l2_reg, real_t l1_new, real_t l1_old,
     real_t w_mult
 );
+/*  Budget for the latency-bounded fold-in variants. The caps in the first
+    block are inputs (zero / non-positive disables each); the rest is filled
+    on output so truncated solves can be told apart from converged ones and
+    routed for later refinement. Field types do not depend on the precision,
+    so the same struct serves both builds. */
+typedef struct poismf_foldin_budget {
+    size_t max_nfeval;   /* cap on objective evaluations (per row) */
+    double max_seconds;  /* wall-clock cap, checked between evaluations */
+    double rel_tol;      /* relative f-improvement stopping tolerance */
+    /* outputs */
+    bool complete;       /* solver stopped on convergence, not on a cap */
+    size_t nfeval;       /* evaluations spent (total over rows) */
+    double fun_val;      /* objective at the returned point (summed) */
+    double residual;     /* projected-gradient norm there (worst row) */
+} poismf_foldin_budget;
+int factors_single_bounded
+(
+    real_t *restrict out, size_t k,
+    real_t *restrict A_old, size_t dimA,
+    real_t *restrict X, sparse_ix X_ind[], size_t nnz,
+    real_t *restrict B, real_t *restrict Bsum,
+    int maxupd, real_t l2_reg, real_t l1_new, real_t l1_old,
+    real_t w_mult,
+    poismf_foldin_budget *restrict budget
+);
+int factors_multiple_bounded
+(
+    real_t *A, real_t *B, real_t *A_old, real_t *Bsum,
+    real_t *Xr, sparse_ix *Xr_indptr, sparse_ix *Xr_indices,
+    int k, size_t dimA,
+    real_t l2_reg, real_t w_mult,
+    size_t maxupd,
+    poismf_foldin_budget *restrict budget,
+    int nthreads
+);
+
+/*  Single-precision build of the library (poismf_f32.c) and the runtime
+    precision dispatchers (dtype.c). The f32 symbols are the exact same code
+    compiled with 'real_t' as float and every external name suffixed, so the
+    two precisions coexist in one binary and can be chosen per call at
+    runtime. Only the entry points a caller would reasonably want in the
+    other precision are declared here; both sets share the 'poismf_opts' /
+    'poismf_stats' / 'Method' types, which do not depend on the precision.
+    Not available when the whole build is already float (USE_FLOAT) or for
+    the R wrapper, which is locked to double. */
+#if !defined(USE_FLOAT) && !defined(_FOR_R) && !defined(POISMF_IX32)
+void sum_by_cols_f32(float *restrict out, float *restrict M, size_t nrow, size_t ncol);
+int run_poismf_f32(
+    float *restrict A, float *restrict Xr, sparse_ix *restrict Xr_indptr, sparse_ix *restrict Xr_indices,
+    float *restrict B, float *restrict Xc, sparse_ix *restrict Xc_indptr, sparse_ix *restrict Xc_indices,
+    const size_t dimA, const size_t dimB, const size_t k,
+    const float l2_reg, const float l1_reg, const float w_mult, float step_size,
+    const Method method, const bool limit_step, const size_t numiter, const size_t maxupd,
+    const bool handle_interrupt, const int nthreads);
+int run_poismf_ext_f32(
+    float *restrict A, float *restrict Xr, sparse_ix *restrict Xr_indptr, sparse_ix *restrict Xr_indices,
+    float *restrict B, float *restrict Xc, sparse_ix *restrict Xc_indptr, sparse_ix *restrict Xc_indices,
+    const size_t dimA, const size_t dimB, const size_t k,
+    const float l2_reg, const float l1_reg, const float w_mult, float step_size,
+    const Method method, const bool limit_step, const size_t numiter, const size_t maxupd,
+    const bool handle_interrupt, const int nthreads,
+    const poismf_opts *restrict opts);
+int topN_f32
+(
+    float *restrict a_vec, float *restrict B, int k,
+    sparse_ix *restrict include_ix, size_t n_include,
+    sparse_ix *restrict exclude_ix, size_t n_exclude,
+    sparse_ix *restrict outp_ix, float *restrict outp_score,
+    size_t n_top, size_t n, int nthreads
+);
+int topN_multiple_f32
+(
+    float *restrict A, size_t dimA, float *restrict B, int k,
+    sparse_ix *restrict outp_ix, float *restrict outp_score,
+    size_t n_top, size_t n, int nthreads
+);
+void predict_multiple_f32
+(
+    float *restrict out,
+    float *restrict A, float *restrict B,
+    sparse_ix *ixA, sparse_ix *ixB,
+    size_t n, int k,
+    int nthreads
+);
+long double eval_llk_f32
+(
+    float *restrict A,
+    float *restrict B,
+    sparse_ix ixA[],
+    sparse_ix ixB[],
+    float *restrict X,
+    size_t nnz, int k,
+    bool full_llk, bool include_missing,
+    size_t dimA, size_t dimB,
+    int nthreads
+);
+int factors_multiple_f32
+(
+    float *A, float *B, float *A_old, float *Bsum,
+    float *Xr, sparse_ix *Xr_indptr, sparse_ix *Xr_indices,
+    int k, size_t dimA,
+    float l2_reg, float w_mult,
+    float step_size, size_t niter, size_t maxupd,
+    Method method, bool limit_step,
+    int nthreads
+);
+int factors_single_f32
+(
+    float *restrict out, size_t k,
+    float *restrict A_old, size_t dimA,
+    float *restrict X, sparse_ix X_ind[], size_t nnz,
+    float *restrict B, float *restrict Bsum,
+    int maxupd, float l2_reg, float l1_new, float l1_old,
+    float w_mult
+);
+int poismf_save_f32
+(
+    const char *path,
+    float *restrict A, float *restrict B,
+    size_t dimA, size_t dimB, size_t k
+);
+/* 'out->A' / 'out->B' point to float data after this one */
+int poismf_mmap_load_f32(const char *path, poismf_mmap_model *restrict out);
+void poismf_mmap_unload_f32(poismf_mmap_model *restrict out);
+
+/* dtype.c */
+typedef enum poismf_dtype {poismf_f64 = 1, poismf_f32 = 2} poismf_dtype;
+int run_poismf_rt(
+    const poismf_dtype dtype,
+    void *restrict A, void *restrict Xr, sparse_ix *restrict Xr_indptr, sparse_ix *restrict Xr_indices,
+    void *restrict B, void *restrict Xc, sparse_ix *restrict Xc_indptr, sparse_ix *restrict Xc_indices,
+    const size_t dimA, const size_t dimB, const size_t k,
+    const double l2_reg, const double l1_reg, const double w_mult, double step_size,
+    const Method method, const bool limit_step, const size_t numiter, const size_t maxupd,
+    const bool handle_interrupt, const int nthreads);
+int topN_rt
+(
+    const poismf_dtype dtype,
+    void *restrict a_vec, void *restrict B, int k,
+    sparse_ix *restrict include_ix, size_t n_include,
+    sparse_ix *restrict exclude_ix, size_t n_exclude,
+    sparse_ix *restrict outp_ix, void *restrict outp_score,
+    size_t n_top, size_t n, int nthreads
+);
+void predict_multiple_rt
+(
+    const poismf_dtype dtype,
+    void *restrict out,
+    void *restrict A, void *restrict B,
+    sparse_ix *ixA, sparse_ix *ixB,
+    size_t n, int k,
+    int nthreads
+);
+#endif
+
+/*  32-bit-index build of the library (poismf_ix32.c), same mechanism as the
+    float32 one: the sources compiled again with 'sparse_ix' as uint32_t and
+    every symbol suffixed. Halves the index memory and tightens the index
+    stream in the per-nonzero loops. In these entry points 'poismf_opts' is
+    shared but 'opts->csc_map' must then point to uint32_t data. */
+#if !defined(USE_FLOAT) && !defined(_FOR_R) && !defined(POISMF_IX32)
+int run_poismf_ix32(
+    double *restrict A, double *restrict Xr, uint32_t *restrict Xr_indptr, uint32_t *restrict Xr_indices,
+    double *restrict B, double *restrict Xc, uint32_t *restrict Xc_indptr, uint32_t *restrict Xc_indices,
+    const size_t dimA, const size_t dimB, const size_t k,
+    const double l2_reg, const double l1_reg, const double w_mult, double step_size,
+    const Method method, const bool limit_step, const size_t numiter, const size_t maxupd,
+    const bool handle_interrupt, const int nthreads);
+int run_poismf_ext_ix32(
+    double *restrict A, double *restrict Xr, uint32_t *restrict Xr_indptr, uint32_t *restrict Xr_indices,
+    double *restrict B, double *restrict Xc, uint32_t *restrict Xc_indptr, uint32_t *restrict Xc_indices,
+    const size_t dimA, const size_t dimB, const size_t k,
+    const double l2_reg, const double l1_reg, const double w_mult, double step_size,
+    const Method method, const bool limit_step, const size_t numiter, const size_t maxupd,
+    const bool handle_interrupt, const int nthreads,
+    const poismf_opts *restrict opts);
+int poismf_build_csc_map_ix32
+(
+    uint32_t *restrict Xr_indptr, uint32_t *restrict Xr_indices,
+    size_t dimA, size_t dimB,
+    uint32_t *restrict Xc_indptr, uint32_t *restrict Xc_indices,
+    uint32_t *restrict csc_map
+);
+int topN_ix32
+(
+    double *restrict a_vec, double *restrict B, int k,
+    uint32_t *restrict include_ix, size_t n_include,
+    uint32_t *restrict exclude_ix, size_t n_exclude,
+    uint32_t *restrict outp_ix, double *restrict outp_score,
+    size_t n_top, size_t n, int nthreads
+);
+int topN_multiple_ix32
+(
+    double *restrict A, size_t dimA, double *restrict B, int k,
+    uint32_t *restrict outp_ix, double *restrict outp_score,
+    size_t n_top, size_t n, int nthreads
+);
+void predict_multiple_ix32
+(
+    double *restrict out,
+    double *restrict A, double *restrict B,
+    uint32_t *ixA, uint32_t *ixB,
+    size_t n, int k,
+    int nthreads
+);
+long double eval_llk_ix32
+(
+    double *restrict A,
+    double *restrict B,
+    uint32_t ixA[],
+    uint32_t ixB[],
+    double *restrict X,
+    size_t nnz, int k,
+    bool full_llk, bool include_missing,
+    size_t dimA, size_t dimB,
+    int nthreads
+);
+int factors_multiple_ix32
+(
+    double *A, double *B, double *A_old, double *Bsum,
+    double *Xr, uint32_t *Xr_indptr, uint32_t *Xr_indices,
+    int k, size_t dimA,
+    double l2_reg, double w_mult,
+    double step_size, size_t niter, size_t maxupd,
+    Method method, bool limit_step,
+    int nthreads
+);
+int factors_single_ix32
+(
+    double *restrict out, size_t k,
+    double *restrict A_old, size_t dimA,
+    double *restrict X, uint32_t X_ind[], size_t nnz,
+    double *restrict B, double *restrict Bsum,
+    int maxupd, double l2_reg, double l1_new, double l1_old,
+    double w_mult
+);
+#endif
 
 #ifdef __cplusplus
 }
 #endif
 
+#endif /* POISMF_H */
+
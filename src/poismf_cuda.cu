@@ -0,0 +1,534 @@
+ /*
+    Poisson Factorization for sparse matrices
+
+    Based on alternating proximal gradient iteration or conjugate gradient.
+    Variables must be initialized from outside the main function ('run_poismf').
+    Writen for C99 standard and OpenMP 2.0 or later.
+
+    Reference paper is:
+        Cortes, David.
+        "Fast Non-Bayesian Poisson Factorization for Implicit-Feedback Recommendations."
+        arXiv preprint arXiv:1811.01908 (2018).
+
+    BSD 2-Clause License
+
+    Copyright (c) 2020, David Cortes
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*  Optional GPU backend for the alternating updates.
+
+    The per-row subproblems are independent and share the same read-only
+    B (or A) matrix, which maps directly onto a GPU: one thread block per
+    row, the row's factor vector staged in shared memory, and the whole
+    alternating loop running with A, B and both sparse views resident on
+    the device - factors only travel back across PCIe at checkpoints and
+    at the end of the fit.
+
+    This file is NOT part of the regular Python/R builds and is never
+    compiled by setup.py. To enable the backend, compile it separately
+    with the CUDA or ROCm toolchain and link it next to the C objects:
+
+        nvcc  -O3 -DPOISMF_CUDA -c poismf_cuda.cu     (NVIDIA)
+        hipcc -O3 -DPOISMF_CUDA -c poismf_cuda.cu     (AMD)
+
+    then call 'run_poismf_cuda' (declared in poismf.h under POISMF_CUDA)
+    in place of 'run_poismf'. Scope compared to the CPU path:
+      - methods 'pg' and 'cg' only ('tncg' returns 2 - the truncated
+        Newton solver's inner CG-over-Hessian loop does not fit the
+        one-block-per-row shape);
+      - 'w_mult' is fixed at 1 (no per-row Bsum copies on the device);
+      - interrupt handling is not available (kernels run to completion);
+      - periodic host checkpoints via 'opts->checkpoint_path' /
+        'opts->checkpoint_every' reuse 'poismf_checkpoint_save'.
+    The conjugate-gradient kernel is a device port of the projected
+    Polak-Ribiere scheme in nonnegcg.c with a backtracking line search;
+    it follows the same objective and projection rules but not the exact
+    evaluation order, so results match the CPU solver to solver tolerance
+    rather than bitwise. */
+#if defined(POISMF_CUDA)
+
+#include "poismf.h"
+
+#if defined(__HIPCC__) || defined(__HIP_PLATFORM_AMD__)
+    #include <hip/hip_runtime.h>
+    #define gpuError_t              hipError_t
+    #define gpuSuccess              hipSuccess
+    #define gpuMalloc               hipMalloc
+    #define gpuFree                 hipFree
+    #define gpuMemcpy               hipMemcpy
+    #define gpuMemcpyHostToDevice   hipMemcpyHostToDevice
+    #define gpuMemcpyDeviceToHost   hipMemcpyDeviceToHost
+    #define gpuGetLastError         hipGetLastError
+    #define gpuGetErrorString       hipGetErrorString
+    #define gpuDeviceSynchronize    hipDeviceSynchronize
+#else
+    #include <cuda_runtime.h>
+    #define gpuError_t              cudaError_t
+    #define gpuSuccess              cudaSuccess
+    #define gpuMalloc               cudaMalloc
+    #define gpuFree                 cudaFree
+    #define gpuMemcpy               cudaMemcpy
+    #define gpuMemcpyHostToDevice   cudaMemcpyHostToDevice
+    #define gpuMemcpyDeviceToHost   cudaMemcpyDeviceToHost
+    #define gpuGetLastError         cudaGetLastError
+    #define gpuGetErrorString       cudaGetErrorString
+    #define gpuDeviceSynchronize    cudaDeviceSynchronize
+#endif
+
+/* Threads per row block - must be a power of two for the reductions */
+#define POISMF_GPU_BLOCK 128
+/* Line-search controls, mirroring the minimize_nonneg_cg call sites */
+#define POISMF_GPU_LNSRCH_DECR   ((real_t)0.25)
+#define POISMF_GPU_LNSRCH_C1     ((real_t)0.01)
+#define POISMF_GPU_LNSRCH_MAX    20
+
+/* Tree reduction over the block; every thread gets the total back */
+static __device__ real_t block_sum(real_t val, real_t *restrict scratch)
+{
+    int tid = threadIdx.x;
+    scratch[tid] = val;
+    __syncthreads();
+    for (int s = blockDim.x/2; s > 0; s >>= 1) {
+        if (tid < s) scratch[tid] += scratch[tid + s];
+        __syncthreads();
+    }
+    val = scratch[0];
+    __syncthreads();
+    return val;
+}
+
+/* Column sums of a row-major [nrow, k] matrix, plus 'l1_reg', times
+   'scal' - one block per column. Produces 'cnst_sum' for the PG update
+   (scal = -step_size) and 'Bsum' for the CG objective (scal = 1). */
+static __global__ void colsum_kernel
+(
+    const real_t *restrict M, size_t nrow, size_t k,
+    real_t l1_reg, real_t scal, real_t *restrict out
+)
+{
+    extern __shared__ real_t scratch[];
+    size_t col = blockIdx.x;
+    real_t part = 0;
+    for (size_t row = threadIdx.x; row < nrow; row += blockDim.x)
+        part += M[row*k + col];
+    part = block_sum(part, scratch);
+    if (threadIdx.x == 0)
+        out[col] = scal * (part + l1_reg);
+}
+
+/*  Gradient of the Poisson likelihood term for one row, accumulated into
+    shared 'grad': sum_ix x_ix/pred_ix * B[ind_ix]. The prediction for
+    each non-zero is a cooperative dot product over the block; with the
+    row vector and the gradient living in shared memory, only the B rows
+    of the non-zeros stream from device memory. */
+static __device__ void row_grad_pos
+(
+    const real_t *restrict a_row, const real_t *restrict B,
+    const real_t *restrict Xr, const sparse_ix *restrict X_ind,
+    size_t st, size_t nnz, size_t k,
+    real_t *restrict grad, real_t *restrict scratch
+)
+{
+    int tid = threadIdx.x;
+    for (size_t ix = 0; ix < nnz; ix++)
+    {
+        const real_t *restrict b_row = B + (size_t)X_ind[st + ix]*k;
+        real_t part = 0;
+        for (size_t j = tid; j < k; j += blockDim.x)
+            part += a_row[j] * b_row[j];
+        real_t pred = block_sum(part, scratch);
+        real_t coef = Xr[st + ix] / pred;
+        for (size_t j = tid; j < k; j += blockDim.x)
+            grad[j] += coef * b_row[j];
+        __syncthreads();
+    }
+}
+
+/* Same walk with the likelihood term subtracted instead - the form the
+   CG objective's gradient needs on top of Bsum + 2*l2*a */
+static __device__ void row_grad_neg
+(
+    const real_t *restrict a_row, const real_t *restrict B,
+    const real_t *restrict Xr, const sparse_ix *restrict X_ind,
+    size_t st, size_t nnz, size_t k,
+    real_t *restrict grad, real_t *restrict scratch
+)
+{
+    int tid = threadIdx.x;
+    for (size_t ix = 0; ix < nnz; ix++)
+    {
+        const real_t *restrict b_row = B + (size_t)X_ind[st + ix]*k;
+        real_t part = 0;
+        for (size_t j = tid; j < k; j += blockDim.x)
+            part += a_row[j] * b_row[j];
+        real_t pred = block_sum(part, scratch);
+        real_t coef = Xr[st + ix] / pred;
+        for (size_t j = tid; j < k; j += blockDim.x)
+            grad[j] -= coef * b_row[j];
+        __syncthreads();
+    }
+}
+
+/*  f(a) = <Bsum, a> + l2*<a, a> - sum_ix x_ix*log(pred_ix), same value on
+    every thread of the block on return. A zero prediction gives +inf,
+    which the line search then rejects - same effect as the step limiting
+    in the CPU solver. */
+static __device__ real_t row_fun
+(
+    const real_t *restrict a_row, const real_t *restrict B,
+    const real_t *restrict Xr, const sparse_ix *restrict X_ind,
+    size_t st, size_t nnz, size_t k,
+    const real_t *restrict Bsum, real_t l2_reg,
+    real_t *restrict scratch
+)
+{
+    int tid = threadIdx.x;
+    real_t part = 0;
+    for (size_t j = tid; j < k; j += blockDim.x)
+        part += Bsum[j]*a_row[j] + l2_reg*a_row[j]*a_row[j];
+    real_t fval = block_sum(part, scratch);
+    for (size_t ix = 0; ix < nnz; ix++)
+    {
+        const real_t *restrict b_row = B + (size_t)X_ind[st + ix]*k;
+        part = 0;
+        for (size_t j = tid; j < k; j += blockDim.x)
+            part += a_row[j] * b_row[j];
+        real_t pred = block_sum(part, scratch);
+        if (tid == 0) scratch[0] = Xr[st + ix] * log(pred);
+        __syncthreads();
+        fval -= scratch[0];
+        __syncthreads();
+    }
+    return fval;
+}
+
+/*  Proximal-gradient update for one row per block, 'maxupd' inner steps.
+    Same arithmetic as 'pg_solve_one': a <- max(0, cnst_div*(a +
+    step*grad + cnst_sum)) with 'cnst_sum' pre-scaled by -step_size.
+    Shared memory: a_row[k] + grad[k] + scratch[blockDim]. */
+static __global__ void pg_row_kernel
+(
+    real_t *restrict A, const real_t *restrict B,
+    const real_t *restrict Xr,
+    const sparse_ix *restrict Xr_indptr, const sparse_ix *restrict Xr_indices,
+    size_t k, const real_t *restrict cnst_sum, real_t cnst_div,
+    real_t step_size, size_t maxupd
+)
+{
+    extern __shared__ real_t smem[];
+    real_t *restrict a_row = smem;
+    real_t *restrict grad = a_row + k;
+    real_t *restrict scratch = grad + k;
+    int tid = threadIdx.x;
+
+    size_t ia = blockIdx.x;
+    size_t st = (size_t)Xr_indptr[ia];
+    size_t nnz = (size_t)Xr_indptr[ia+1] - st;
+    if (nnz == 0) {
+        for (size_t j = tid; j < k; j += blockDim.x)
+            A[ia*k + j] = 0;
+        return;
+    }
+
+    for (size_t j = tid; j < k; j += blockDim.x)
+        a_row[j] = A[ia*k + j];
+    __syncthreads();
+
+    for (size_t upd = 0; upd < maxupd; upd++)
+    {
+        for (size_t j = tid; j < k; j += blockDim.x)
+            grad[j] = 0;
+        __syncthreads();
+        row_grad_pos(a_row, B, Xr, Xr_indices, st, nnz, k, grad, scratch);
+        for (size_t j = tid; j < k; j += blockDim.x)
+        {
+            real_t val = cnst_div * (a_row[j] + step_size*grad[j]
+                                              + cnst_sum[j]);
+            a_row[j] = (val >= 0)? val : 0;
+        }
+        __syncthreads();
+    }
+
+    for (size_t j = tid; j < k; j += blockDim.x)
+        A[ia*k + j] = a_row[j];
+}
+
+/*  Projected Polak-Ribiere CG for one row per block, 'maxupd' outer
+    iterations with a backtracking line search (device port of the
+    scheme in nonnegcg.c). Directions are zeroed on the active set
+    (a[j] == 0 with the direction pointing outward), trial points are
+    clipped at zero, and beta restarts to steepest descent when negative.
+    Shared memory: a_row/grad/grad_old/dir/a_try [k each] +
+    scratch[blockDim]. */
+static __global__ void cg_row_kernel
+(
+    real_t *restrict A, const real_t *restrict B,
+    const real_t *restrict Xr,
+    const sparse_ix *restrict Xr_indptr, const sparse_ix *restrict Xr_indices,
+    size_t k, const real_t *restrict Bsum, real_t l2_reg,
+    bool limit_step, size_t maxupd
+)
+{
+    extern __shared__ real_t smem[];
+    real_t *restrict a_row = smem;
+    real_t *restrict grad = a_row + k;
+    real_t *restrict grad_old = grad + k;
+    real_t *restrict dir = grad_old + k;
+    real_t *restrict a_try = dir + k;
+    real_t *restrict scratch = a_try + k;
+    int tid = threadIdx.x;
+
+    size_t ia = blockIdx.x;
+    size_t st = (size_t)Xr_indptr[ia];
+    size_t nnz = (size_t)Xr_indptr[ia+1] - st;
+    if (nnz == 0) {
+        for (size_t j = tid; j < k; j += blockDim.x)
+            A[ia*k + j] = 0;
+        return;
+    }
+
+    for (size_t j = tid; j < k; j += blockDim.x)
+        a_row[j] = A[ia*k + j];
+    __syncthreads();
+
+    /* grad = Bsum + 2*l2*a - sum x/pred * b;  dir = projected -grad */
+    for (size_t j = tid; j < k; j += blockDim.x)
+        grad[j] = Bsum[j] + 2*l2_reg*a_row[j];
+    __syncthreads();
+    row_grad_neg(a_row, B, Xr, Xr_indices, st, nnz, k, grad, scratch);
+    for (size_t j = tid; j < k; j += blockDim.x)
+        dir[j] = (a_row[j] <= 0 && grad[j] > 0)? 0 : -grad[j];
+    __syncthreads();
+
+    for (size_t iter = 0; iter < maxupd; iter++)
+    {
+        real_t part = 0;
+        for (size_t j = tid; j < k; j += blockDim.x)
+            part += grad[j] * dir[j];
+        real_t gd = block_sum(part, scratch);
+        if (gd >= 0) break;  /* no descent left on the feasible set */
+
+        real_t f0 = row_fun(a_row, B, Xr, Xr_indices, st, nnz, k,
+                            Bsum, l2_reg, scratch);
+
+        /* optionally shrink the first trial so huge directions do not
+           shoot the predictions into log-overflow territory */
+        real_t t = 1;
+        if (limit_step) {
+            part = 0;
+            for (size_t j = tid; j < k; j += blockDim.x)
+                part += dir[j]*dir[j];
+            real_t dnorm = sqrt(block_sum(part, scratch));
+            if (dnorm > 1) t = 1 / dnorm;
+        }
+
+        bool accepted = false;
+        for (int ls = 0; ls < POISMF_GPU_LNSRCH_MAX; ls++)
+        {
+            for (size_t j = tid; j < k; j += blockDim.x) {
+                real_t val = a_row[j] + t*dir[j];
+                a_try[j] = (val >= 0)? val : 0;
+            }
+            __syncthreads();
+            real_t f1 = row_fun(a_try, B, Xr, Xr_indices, st, nnz, k,
+                                Bsum, l2_reg, scratch);
+            if (f1 <= f0 + POISMF_GPU_LNSRCH_C1 * t * gd) {
+                accepted = true;
+                break;
+            }
+            t *= POISMF_GPU_LNSRCH_DECR;
+        }
+        if (!accepted) break;
+
+        for (size_t j = tid; j < k; j += blockDim.x) {
+            a_row[j] = a_try[j];
+            grad_old[j] = grad[j];
+            grad[j] = Bsum[j] + 2*l2_reg*a_row[j];
+        }
+        __syncthreads();
+        row_grad_neg(a_row, B, Xr, Xr_indices, st, nnz, k, grad, scratch);
+
+        /* Polak-Ribiere with restart on negative beta */
+        real_t num = 0, den = 0;
+        for (size_t j = tid; j < k; j += blockDim.x) {
+            num += grad[j] * (grad[j] - grad_old[j]);
+            den += grad_old[j] * grad_old[j];
+        }
+        num = block_sum(num, scratch);
+        den = block_sum(den, scratch);
+        real_t beta = (den > 0 && num > 0)? (num / den) : 0;
+        for (size_t j = tid; j < k; j += blockDim.x) {
+            real_t d = -grad[j] + beta*dir[j];
+            dir[j] = (a_row[j] <= 0 && d < 0)? 0 : d;
+        }
+        __syncthreads();
+    }
+
+    for (size_t j = tid; j < k; j += blockDim.x)
+        A[ia*k + j] = a_row[j];
+}
+
+#define cleanup_gpu(ptr) do { if ((ptr) != NULL) gpuFree(ptr); } while (0)
+
+/*  Device-resident counterpart of 'run_poismf' - see the file comment for
+    the supported subset. 'opts' may be NULL; 'opts->stats->iter_done' is
+    maintained so progress is visible from the host between checkpoints.
+    Returns 0 on success, 1 on out-of-memory or device errors, 2 on
+    invalid inputs. */
+extern "C"
+int run_poismf_cuda
+(
+    real_t *restrict A, real_t *restrict Xr,
+    sparse_ix *restrict Xr_indptr, sparse_ix *restrict Xr_indices,
+    real_t *restrict B, real_t *restrict Xc,
+    sparse_ix *restrict Xc_indptr, sparse_ix *restrict Xc_indices,
+    const size_t dimA, const size_t dimB, const size_t k,
+    const real_t l2_reg, const real_t l1_reg, real_t step_size,
+    const Method method, const bool limit_step,
+    const size_t numiter, const size_t maxupd,
+    const poismf_opts *opts
+)
+{
+    if (method != pg && method != cg) return 2;
+    if (Xc == NULL || Xc_indptr == NULL || Xc_indices == NULL) return 2;
+
+    int retval = 0;
+    size_t nnz = (size_t)Xr_indptr[dimA];
+    poismf_stats *stats = (opts != NULL)? opts->stats : NULL;
+    const char *ckpt_path = (opts != NULL)? opts->checkpoint_path : NULL;
+    uint64_t ckpt_every = (opts != NULL)? opts->checkpoint_every : 0;
+    gpuError_t err;
+
+    real_t *d_A = NULL, *d_B = NULL, *d_Xr = NULL, *d_Xc = NULL;
+    real_t *d_sum = NULL;
+    sparse_ix *d_Xr_indptr = NULL, *d_Xr_indices = NULL;
+    sparse_ix *d_Xc_indptr = NULL, *d_Xc_indices = NULL;
+
+    size_t sh_pg = (2*k + POISMF_GPU_BLOCK) * sizeof(real_t);
+    size_t sh_cg = (5*k + POISMF_GPU_BLOCK) * sizeof(real_t);
+    size_t sh_colsum = POISMF_GPU_BLOCK * sizeof(real_t);
+    real_t cnst_div = 1 / (1 + 2*l2_reg*step_size);
+
+    if (gpuMalloc((void**)&d_A, dimA*k*sizeof(real_t)) != gpuSuccess ||
+        gpuMalloc((void**)&d_B, dimB*k*sizeof(real_t)) != gpuSuccess ||
+        gpuMalloc((void**)&d_Xr, nnz*sizeof(real_t)) != gpuSuccess ||
+        gpuMalloc((void**)&d_Xc, nnz*sizeof(real_t)) != gpuSuccess ||
+        gpuMalloc((void**)&d_sum, k*sizeof(real_t)) != gpuSuccess ||
+        gpuMalloc((void**)&d_Xr_indptr, (dimA+1)*sizeof(sparse_ix)) != gpuSuccess ||
+        gpuMalloc((void**)&d_Xr_indices, nnz*sizeof(sparse_ix)) != gpuSuccess ||
+        gpuMalloc((void**)&d_Xc_indptr, (dimB+1)*sizeof(sparse_ix)) != gpuSuccess ||
+        gpuMalloc((void**)&d_Xc_indices, nnz*sizeof(sparse_ix)) != gpuSuccess)
+    {
+        fprintf(stderr, "Error: out of memory.\n");
+        retval = 1;
+        goto cleanup;
+    }
+
+    gpuMemcpy(d_A, A, dimA*k*sizeof(real_t), gpuMemcpyHostToDevice);
+    gpuMemcpy(d_B, B, dimB*k*sizeof(real_t), gpuMemcpyHostToDevice);
+    gpuMemcpy(d_Xr, Xr, nnz*sizeof(real_t), gpuMemcpyHostToDevice);
+    gpuMemcpy(d_Xc, Xc, nnz*sizeof(real_t), gpuMemcpyHostToDevice);
+    gpuMemcpy(d_Xr_indptr, Xr_indptr, (dimA+1)*sizeof(sparse_ix), gpuMemcpyHostToDevice);
+    gpuMemcpy(d_Xr_indices, Xr_indices, nnz*sizeof(sparse_ix), gpuMemcpyHostToDevice);
+    gpuMemcpy(d_Xc_indptr, Xc_indptr, (dimB+1)*sizeof(sparse_ix), gpuMemcpyHostToDevice);
+    gpuMemcpy(d_Xc_indices, Xc_indices, nnz*sizeof(sparse_ix), gpuMemcpyHostToDevice);
+
+    for (size_t fulliter = 0; fulliter < numiter; fulliter++)
+    {
+        /* A given B */
+        if (method == pg)
+        {
+            colsum_kernel<<<(unsigned)k, POISMF_GPU_BLOCK, sh_colsum>>>
+                (d_B, dimB, k, l1_reg, -step_size, d_sum);
+            pg_row_kernel<<<(unsigned)dimA, POISMF_GPU_BLOCK, sh_pg>>>
+                (d_A, d_B, d_Xr, d_Xr_indptr, d_Xr_indices,
+                 k, d_sum, cnst_div, step_size, maxupd);
+        }
+        else
+        {
+            colsum_kernel<<<(unsigned)k, POISMF_GPU_BLOCK, sh_colsum>>>
+                (d_B, dimB, k, l1_reg, 1, d_sum);
+            cg_row_kernel<<<(unsigned)dimA, POISMF_GPU_BLOCK, sh_cg>>>
+                (d_A, d_B, d_Xr, d_Xr_indptr, d_Xr_indices,
+                 k, d_sum, l2_reg, limit_step, maxupd);
+        }
+
+        /* B given A */
+        if (method == pg)
+        {
+            colsum_kernel<<<(unsigned)k, POISMF_GPU_BLOCK, sh_colsum>>>
+                (d_A, dimA, k, l1_reg, -step_size, d_sum);
+            pg_row_kernel<<<(unsigned)dimB, POISMF_GPU_BLOCK, sh_pg>>>
+                (d_B, d_A, d_Xc, d_Xc_indptr, d_Xc_indices,
+                 k, d_sum, cnst_div, step_size, maxupd);
+            step_size *= 0.5;
+            cnst_div = 1 / (1 + 2*l2_reg*step_size);
+        }
+        else
+        {
+            colsum_kernel<<<(unsigned)k, POISMF_GPU_BLOCK, sh_colsum>>>
+                (d_A, dimA, k, l1_reg, 1, d_sum);
+            cg_row_kernel<<<(unsigned)dimB, POISMF_GPU_BLOCK, sh_cg>>>
+                (d_B, d_A, d_Xc, d_Xc_indptr, d_Xc_indices,
+                 k, d_sum, l2_reg, limit_step, maxupd);
+        }
+
+        err = gpuDeviceSynchronize();
+        if (err == gpuSuccess) err = gpuGetLastError();
+        if (err != gpuSuccess)
+        {
+            fprintf(stderr, "Error: GPU error: %s\n", gpuGetErrorString(err));
+            retval = 1;
+            goto cleanup;
+        }
+        if (stats != NULL) stats->iter_done = (uint64_t)(fulliter + 1);
+
+        if (ckpt_path != NULL && ckpt_every != 0 &&
+            (uint64_t)(fulliter+1) % ckpt_every == 0)
+        {
+            gpuMemcpy(A, d_A, dimA*k*sizeof(real_t), gpuMemcpyDeviceToHost);
+            gpuMemcpy(B, d_B, dimB*k*sizeof(real_t), gpuMemcpyDeviceToHost);
+            poismf_checkpoint_save(ckpt_path, A, B, dimA, dimB, k,
+                                   (uint64_t)(fulliter+1), (double)step_size);
+        }
+    }
+
+    gpuMemcpy(A, d_A, dimA*k*sizeof(real_t), gpuMemcpyDeviceToHost);
+    gpuMemcpy(B, d_B, dimB*k*sizeof(real_t), gpuMemcpyDeviceToHost);
+
+    cleanup:
+        cleanup_gpu(d_A);
+        cleanup_gpu(d_B);
+        cleanup_gpu(d_Xr);
+        cleanup_gpu(d_Xc);
+        cleanup_gpu(d_sum);
+        cleanup_gpu(d_Xr_indptr);
+        cleanup_gpu(d_Xr_indices);
+        cleanup_gpu(d_Xc_indptr);
+        cleanup_gpu(d_Xc_indices);
+    return retval;
+}
+
+#endif /* POISMF_CUDA */
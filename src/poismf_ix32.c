@@ -0,0 +1,153 @@
+ /*
+    Poisson Factorization for sparse matrices
+
+    Based on alternating proximal gradient iteration or conjugate gradient.
+    Variables must be initialized from outside the main function ('run_poismf').
+    Writen for C99 standard and OpenMP 2.0 or later.
+
+    Reference paper is:
+        Cortes, David.
+        "Fast Non-Bayesian Poisson Factorization for Implicit-Feedback Recommendations."
+        arXiv preprint arXiv:1811.01908 (2018).
+
+    BSD 2-Clause License
+
+    Copyright (c) 2020, David Cortes
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*  32-bit-index build of the library in one translation unit, following the
+    same pattern as the float32 one (poismf_ix32.c): the sources are written
+    against the 'sparse_ix' alias, so compiling them again with POISMF_IX32
+    defined and every external symbol renamed gives a copy of the library
+    whose index arrays are uint32_t - half the index memory, and a denser
+    index stream in the per-nonzero loops where it competes with the B rows
+    for bandwidth. See the '_ix32' declarations in poismf.h.
+
+    Not compiled when the base build is already 32-bit, nor inside the
+    float build (the '_ix32' declarations in poismf.h are double-only),
+    nor for the R wrapper, which has its own index type. */
+#if !defined(POISMF_IX32) && !defined(USE_FLOAT) && !defined(_FOR_R)
+
+#if !defined(_WIN32) && !defined(_WIN64) && !defined(_DEFAULT_SOURCE)
+    #define _DEFAULT_SOURCE /* for 'madvise' in ooc.c */
+#endif
+
+#define POISMF_IX32
+
+/* poismf.c */
+#define dscal_large                 dscal_large_ix32
+#define sum_by_cols                 sum_by_cols_ix32
+#define sum_by_cols_parallel        sum_by_cols_parallel_ix32
+#define sum_by_cols_delta           sum_by_cols_delta_ix32
+#define adjustment_Bsum             adjustment_Bsum_ix32
+#define calc_grad_pgd               calc_grad_pgd_ix32
+#define poismf_first_touch          poismf_first_touch_ix32
+#define poismf_build_csc_map        poismf_build_csc_map_ix32
+#define pg_iteration                pg_iteration_ix32
+#define calc_fun_single             calc_fun_single_ix32
+#define calc_grad_single            calc_grad_single_ix32
+#define calc_grad_single_w          calc_grad_single_w_ix32
+#define calc_fun_and_grad           calc_fun_and_grad_ix32
+#define cg_iteration                cg_iteration_ix32
+#define tncg_iteration              tncg_iteration_ix32
+#define poismf_opts_init            poismf_opts_init_ix32
+#define poismf_stats_init           poismf_stats_init_ix32
+#define poismf_workspace_init       poismf_workspace_init_ix32
+#define poismf_workspace_free       poismf_workspace_free_ix32
+#define set_interrup_global_variable set_interrup_global_variable_ix32
+#define should_stop_procedure       should_stop_procedure_ix32
+#define run_poismf                  run_poismf_ix32
+#define run_poismf_ext              run_poismf_ext_ix32
+#define run_poismf_incremental      run_poismf_incremental_ix32
+#define run_poismf_resume           run_poismf_resume_ix32
+
+/* pred.c */
+#define predict_multiple            predict_multiple_ix32
+#define predict_csr                 predict_csr_ix32
+#define eval_llk                    eval_llk_ix32
+#define factors_multiple            factors_multiple_ix32
+#define factors_single              factors_single_ix32
+#define factors_single_bounded      factors_single_bounded_ix32
+#define factors_multiple_bounded    factors_multiple_bounded_ix32
+#define factors_single_ctx          factors_single_ctx_ix32
+#define poismf_foldin_ctx_init      poismf_foldin_ctx_init_ix32
+#define poismf_foldin_ctx_free      poismf_foldin_ctx_free_ix32
+
+/* topN.c */
+#define check_is_sorted             check_is_sorted_ix32
+#define qs_argpartition             qs_argpartition_ix32
+#define cmp_size_t                  cmp_size_t_ix32
+#define cmp_argsort                 cmp_argsort_ix32
+#define ptr_real_t_glob             ptr_real_t_glob_ix32
+#define topN                        topN_ix32
+#define topN_multiple               topN_multiple_ix32
+#define poismf_exclude_set_init     poismf_exclude_set_init_ix32
+#define poismf_exclude_set_add      poismf_exclude_set_add_ix32
+#define poismf_exclude_set_from_row poismf_exclude_set_from_row_ix32
+#define poismf_exclude_set_free     poismf_exclude_set_free_ix32
+#define topN_excl                   topN_excl_ix32
+
+/* mips.c */
+#define poismf_mips_index_build     poismf_mips_index_build_ix32
+#define poismf_mips_index_free      poismf_mips_index_free_ix32
+#define topN_approx                 topN_approx_ix32
+
+/* simd_kernels.c */
+#define fused_fun                   fused_fun_ix32
+#define fused_grad                  fused_grad_ix32
+#define fused_fun_grad              fused_fun_grad_ix32
+#define poismf_pack_B               poismf_pack_B_ix32
+#define fused_fun_packed            fused_fun_packed_ix32
+#define fused_grad_packed           fused_grad_packed_ix32
+#define fused_fun_grad_packed       fused_fun_grad_packed_ix32
+#define poismf_vlog                 poismf_vlog_ix32
+
+/* serialize.c / ooc.c */
+#define poismf_save                 poismf_save_ix32
+#define poismf_mmap_load            poismf_mmap_load_ix32
+#define poismf_mmap_unload          poismf_mmap_unload_ix32
+#define poismf_checkpoint_save      poismf_checkpoint_save_ix32
+#define poismf_checkpoint_load      poismf_checkpoint_load_ix32
+#define poismf_shard_save           poismf_shard_save_ix32
+#define poismf_shard_open           poismf_shard_open_ix32
+#define poismf_shard_close          poismf_shard_close_ix32
+#define run_poismf_ooc              run_poismf_ooc_ix32
+
+/* nonnegcg.c / tnc.c */
+#define minimize_nonneg_cg          minimize_nonneg_cg_ix32
+#define tnc                         tnc_ix32
+#define tnc_rc_string               tnc_rc_string_ix32
+
+#include "poismf.c"
+#include "pred.c"
+#include "topN.c"
+#include "mips.c"
+#include "simd_kernels.c"
+#include "serialize.c"
+#include "ooc.c"
+#include "nonnegcg.c"
+#include "tnc.c"
+
+#endif /* !defined(POISMF_IX32) && !defined(USE_FLOAT) && !defined(_FOR_R) */
@@ -0,0 +1,335 @@
+ /*
+    Poisson Factorization for sparse matrices
+
+    Based on alternating proximal gradient iteration or conjugate gradient.
+    Variables must be initialized from outside the main function ('run_poismf').
+    Writen for C99 standard and OpenMP 2.0 or later.
+
+    Reference paper is:
+        Cortes, David.
+        "Fast Non-Bayesian Poisson Factorization for Implicit-Feedback Recommendations."
+        arXiv preprint arXiv:1811.01908 (2018).
+
+    BSD 2-Clause License
+
+    Copyright (c) 2020, David Cortes
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*  Multi-node distributed training over MPI.
+
+    The alternating structure shards cleanly by rows: each rank owns a
+    contiguous range of A rows (users) and a contiguous range of B rows
+    (items), holds only its own slices of the data - the CSR rows of its
+    users and the CSC rows of its items - and runs the unmodified
+    '*_iteration' solvers on them. Both factor matrices are replicated
+    (they are the small part: factors are GBs where the data is TBs);
+    after each half-iteration the freshly-updated panels are exchanged,
+    and the column sums that couple the per-row subproblems are combined
+    with one k-length allreduce per phase. Per full iteration each rank
+    therefore communicates its own panels plus 2k numbers, independent
+    of the non-zero count.
+
+    This file is NOT part of the regular Python/R builds. Compile it
+    separately with the MPI compiler wrapper and link it with the C
+    objects:
+
+        mpicc -O3 -fopenmp -DPOISMF_MPI -c poismf_mpi.c
+
+    Like 'run_poismf_ooc', this driver covers the unweighted case
+    (w_mult = 1) and mirrors its per-phase constant handling, so a
+    single-rank run matches the out-of-core driver's results. */
+#if defined(POISMF_MPI)
+
+#include "poismf.h"
+#include <mpi.h>
+
+extern bool should_stop_procedure;
+
+#ifdef USE_FLOAT
+    #define POISMF_MPI_REAL MPI_FLOAT
+#else
+    #define POISMF_MPI_REAL MPI_DOUBLE
+#endif
+
+/* MPI counts are ints - large panels go out in bounded pieces */
+#define POISMF_MPI_CHUNK ((size_t)1 << 28)
+
+static void mpi_bcast_large
+(
+    real_t *restrict buf, size_t n_elts, int root, MPI_Comm comm
+)
+{
+    for (size_t at = 0; at < n_elts; at += POISMF_MPI_CHUNK)
+    {
+        size_t n_this = ((n_elts - at) < POISMF_MPI_CHUNK)?
+                         (n_elts - at) : POISMF_MPI_CHUNK;
+        MPI_Bcast(buf + at, (int)n_this, POISMF_MPI_REAL, root, comm);
+    }
+}
+
+/* Every rank broadcasts its own freshly-updated panel; afterwards the
+   full matrix is identical everywhere again */
+static void mpi_exchange_panels
+(
+    real_t *restrict M, size_t k,
+    const uint64_t *restrict row_st, const uint64_t *restrict row_ct,
+    int nranks, MPI_Comm comm
+)
+{
+    for (int r = 0; r < nranks; r++)
+        mpi_bcast_large(M + (size_t)row_st[r]*k, (size_t)row_ct[r]*k,
+                        r, comm);
+}
+
+/* Column sums that would be taken over the full matrix on one box:
+   each rank sums its own panel, one k-length allreduce combines them */
+static void mpi_colsums
+(
+    real_t *restrict out, real_t *restrict scratch,
+    real_t *restrict M_panel, size_t dim_loc, size_t k,
+    int nthreads, MPI_Comm comm
+)
+{
+    sum_by_cols_parallel(scratch, M_panel, dim_loc, k, nthreads);
+    MPI_Allreduce(scratch, out, (int)k, POISMF_MPI_REAL, MPI_SUM, comm);
+}
+
+/* Interrupts must be agreed on - a rank stopping alone would leave the
+   others blocked in the next collective */
+static bool mpi_should_stop(MPI_Comm comm)
+{
+    int stop_loc = should_stop_procedure;
+    int stop_all = 0;
+    MPI_Allreduce(&stop_loc, &stop_all, 1, MPI_INT, MPI_LOR, comm);
+    return stop_all != 0;
+}
+
+/*  Distributed counterpart of 'run_poismf' (see the file comment for the
+    sharding). Every rank passes:
+      A, B                 : the FULL factor matrices (replicated; this
+                             rank updates rows [row_stA, row_stA+dimA_loc)
+                             of A and [row_stB, row_stB+dimB_loc) of B)
+      Xr, Xr_indptr,
+      Xr_indices           : CSR slice of this rank's user rows, indptr
+                             rebased to start at zero, item indices global
+      Xc, Xc_indptr,
+      Xc_indices           : CSC slice of this rank's item rows, likewise
+                             rebased, user indices global
+    The row ranges must tile [0, dimA) and [0, dimB) exactly across the
+    communicator (validated up front). Initial factors must be identical
+    on every rank - initialize on rank 0 and broadcast, or seed alike.
+    Returns 0 on success, 1 on out-of-memory, 2 on invalid sharding, the
+    same code on every rank. */
+int run_poismf_mpi(
+    MPI_Comm comm,
+    real_t *restrict A, real_t *restrict Xr, sparse_ix *restrict Xr_indptr, sparse_ix *restrict Xr_indices,
+    real_t *restrict B, real_t *restrict Xc, sparse_ix *restrict Xc_indptr, sparse_ix *restrict Xc_indices,
+    const size_t dimA, const size_t dimB, const size_t k,
+    const size_t row_stA, const size_t dimA_loc,
+    const size_t row_stB, const size_t dimB_loc,
+    const real_t l2_reg, const real_t l1_reg, real_t step_size,
+    const Method method, const bool limit_step, const size_t numiter, const size_t maxupd,
+    const bool handle_interrupt, const int nthreads)
+{
+    int nranks, rank;
+    MPI_Comm_size(comm, &nranks);
+    MPI_Comm_rank(comm, &rank);
+
+    real_t *cnst_sum = (real_t*) malloc(sizeof(real_t) * k);
+    real_t *sum_scratch = (real_t*) malloc(sizeof(real_t) * k);
+    real_t cnst_div;
+    int k_int = (int) k;
+    real_t neg_step_sz = -step_size;
+    size_t size_buffer = 1;
+    switch(method) {
+        case pg:   {size_buffer = 1;  break;}
+        case cg:   {size_buffer = 5;  break;}
+        case tncg: {size_buffer = 22; break;}
+    }
+    size_buffer *= (k * (size_t)nthreads);
+    real_t *buffer_arr = (real_t*) malloc(sizeof(real_t) * size_buffer);
+    int *buffer_int = NULL;
+    real_t *zeros_tncg = NULL;
+    real_t *inf_tncg = NULL;
+    uint64_t *shard_st = NULL;
+    uint64_t *shard_ct = NULL;
+    uint64_t range_loc[4] = {(uint64_t)row_stA, (uint64_t)dimA_loc,
+                             (uint64_t)row_stB, (uint64_t)dimB_loc};
+    uint64_t *ranges = NULL;
+    int ret_code = 0;
+    should_stop_procedure = false;
+
+    shard_st = (uint64_t*)malloc((size_t)2*nranks*sizeof(uint64_t));
+    shard_ct = (uint64_t*)malloc((size_t)2*nranks*sizeof(uint64_t));
+    ranges = (uint64_t*)malloc((size_t)4*nranks*sizeof(uint64_t));
+
+    if (method == tncg) {
+        buffer_int = (int*)malloc(sizeof(int) * k *(size_t)nthreads);
+        zeros_tncg = (real_t*)calloc(sizeof(real_t), k);
+        inf_tncg = (real_t*)malloc(sizeof(real_t) * k);
+        if (buffer_int == NULL || zeros_tncg == NULL || inf_tncg == NULL)
+            goto throw_oom;
+        for (size_t ix = 0; ix < k; ix++)
+            inf_tncg[ix] = HUGE_VAL;
+    }
+
+    if (buffer_arr == NULL || cnst_sum == NULL || sum_scratch == NULL ||
+        shard_st == NULL || shard_ct == NULL || ranges == NULL)
+    {
+        throw_oom:
+            fprintf(stderr, "Error: out of memory.\n");
+            ret_code = 1;
+            goto cleanup;
+    }
+
+    /* Gather every rank's ranges once and check they tile both matrices */
+    MPI_Allgather(range_loc, 4, MPI_UINT64_T, ranges, 4, MPI_UINT64_T, comm);
+    {
+        uint64_t covA = 0, covB = 0;
+        for (int r = 0; r < nranks; r++) {
+            shard_st[r] = ranges[4*r];
+            shard_ct[r] = ranges[4*r + 1];
+            shard_st[nranks + r] = ranges[4*r + 2];
+            shard_ct[nranks + r] = ranges[4*r + 3];
+            if (shard_st[r] != covA || shard_st[nranks + r] != covB) {
+                fprintf(stderr, "Error: shard row ranges do not tile the factor matrices.\n");
+                ret_code = 2;
+                goto cleanup;
+            }
+            covA += shard_ct[r];
+            covB += shard_ct[nranks + r];
+        }
+        if (covA != (uint64_t)dimA || covB != (uint64_t)dimB) {
+            fprintf(stderr, "Error: shard row ranges do not tile the factor matrices.\n");
+            ret_code = 2;
+            goto cleanup;
+        }
+    }
+
+    for (size_t fulliter = 0; fulliter < numiter; fulliter++){
+
+        if (handle_interrupt)
+            signal(SIGINT, set_interrup_global_variable);
+        if (mpi_should_stop(comm)) goto cleanup;
+
+        /* Constants to use later */
+        cnst_div = 1. / (1. + 2. * l2_reg * step_size);
+        mpi_colsums(cnst_sum, sum_scratch, B + row_stB*k, dimB_loc, k,
+                    nthreads, comm);
+        if (l1_reg > 0.)
+            for (size_t kk = 0; kk < k; kk++) cnst_sum[kk] += l1_reg;
+        if (method == pg)
+            cblas_tscal(k_int, neg_step_sz, cnst_sum, 1);
+
+        switch (method) {
+            case pg:
+            {
+                pg_iteration(A + row_stA*k, B, Xr, Xr_indptr, Xr_indices,
+                             dimA_loc, k, NULL, NULL, cnst_div, cnst_sum, NULL,
+                             step_size, 1., maxupd, buffer_arr, NULL, nthreads);
+                break;
+            }
+            case cg:
+            {
+                cg_iteration(A + row_stA*k, B, Xr, Xr_indptr, Xr_indices,
+                             dimA_loc, k, NULL, NULL, limit_step, cnst_sum,
+                             l2_reg, 1., maxupd, buffer_arr, NULL, NULL, nthreads);
+                break;
+            }
+            case tncg:
+            {
+                tncg_iteration(A + row_stA*k, B, Xr, Xr_indptr, Xr_indices,
+                               dimA_loc, k, NULL, NULL, cnst_sum, l2_reg, 1., maxupd,
+                               buffer_arr, buffer_int,
+                               zeros_tncg, inf_tncg, NULL,
+                               NULL, 0, 0, NULL, nthreads);
+                break;
+            }
+        }
+        mpi_exchange_panels(A, k, shard_st, shard_ct, nranks, comm);
+
+        if (handle_interrupt)
+            signal(SIGINT, set_interrup_global_variable);
+        if (mpi_should_stop(comm)) goto cleanup;
+
+        /* Same procedure repeated for the B matrix */
+        mpi_colsums(cnst_sum, sum_scratch, A + row_stA*k, dimA_loc, k,
+                    nthreads, comm);
+        if (l1_reg > 0.)
+            for (size_t kk = 0; kk < k; kk++) cnst_sum[kk] += l1_reg;
+        if (method == pg)
+            cblas_tscal(k_int, neg_step_sz, cnst_sum, 1);
+
+        switch (method) {
+            case pg:
+            {
+                pg_iteration(B + row_stB*k, A, Xc, Xc_indptr, Xc_indices,
+                             dimB_loc, k, NULL, NULL, cnst_div, cnst_sum, NULL,
+                             step_size, 1., maxupd, buffer_arr, NULL, nthreads);
+                break;
+            }
+            case cg:
+            {
+                cg_iteration(B + row_stB*k, A, Xc, Xc_indptr, Xc_indices,
+                             dimB_loc, k, NULL, NULL, limit_step, cnst_sum,
+                             l2_reg, 1., maxupd, buffer_arr, NULL, NULL, nthreads);
+                break;
+            }
+            case tncg:
+            {
+                tncg_iteration(B + row_stB*k, A, Xc, Xc_indptr, Xc_indices,
+                               dimB_loc, k, NULL, NULL, cnst_sum, l2_reg, 1., maxupd,
+                               buffer_arr, buffer_int,
+                               zeros_tncg, inf_tncg, NULL,
+                               NULL, 0, 0, NULL, nthreads);
+                break;
+            }
+        }
+        mpi_exchange_panels(B, k, shard_st + nranks, shard_ct + nranks,
+                            nranks, comm);
+
+        /* Decrease step size after taking PGD steps in both matrices */
+        if (method == pg) {
+            step_size *= 0.5;
+            neg_step_sz = -step_size;
+        }
+    }
+
+    cleanup:
+        free(cnst_sum);
+        free(sum_scratch);
+        free(buffer_arr);
+        free(buffer_int);
+        free(zeros_tncg);
+        free(inf_tncg);
+        free(shard_st);
+        free(shard_ct);
+        free(ranges);
+        should_stop_procedure = false;
+
+    return ret_code;
+}
+
+#endif /* POISMF_MPI */
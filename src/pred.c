@@ -63,6 +63,86 @@ void predict_multiple
     }
 }
 
+/*  CSR-batched variant of 'predict_multiple' for scoring sets of items that
+    are grouped by user (e.g. the test non-zeros in offline evaluation). Per
+    user, the B rows for that user's items are gathered into a per-thread
+    contiguous panel and scored with a single GEMV, which keeps 'a_vec' hot
+    and streams the panel sequentially instead of issuing one strided dot
+    per (user, item) pair. Predictions land in 'out' in the same positions
+    as 'Xr_indices'. Rows too small to repay the gather, or larger than the
+    panel cap, fall back to the plain dot loop (as does everything if the
+    panels cannot be allocated). */
+
+/* Below this many items the gather costs more than it saves */
+#define PRED_CSR_MIN_PANEL ((size_t)8)
+/* Cap (in items) on the per-thread panels, like the heavy-row cap of the
+   tncg solver - bounds memory for pathological rows */
+#define PRED_CSR_PANEL_CAP ((size_t)65536)
+
+void predict_csr
+(
+    real_t *restrict out,
+    real_t *restrict A, real_t *restrict B,
+    sparse_ix *restrict Xr_indptr, sparse_ix *restrict Xr_indices,
+    size_t dimA, int k,
+    int nthreads
+)
+{
+    #if defined(_OPENMP) && ((_OPENMP < 200801) || defined(_WIN32) || defined(_WIN64))
+    long long row = 0;
+    #else
+    size_t row = 0;
+    #endif
+
+    size_t k_szt = (size_t) k;
+    size_t max_nnz = 0;
+    for (size_t ia = 0; ia < dimA; ia++) {
+        size_t nnz_this = Xr_indptr[ia + 1] - Xr_indptr[ia];
+        max_nnz = (nnz_this > max_nnz)? nnz_this : max_nnz;
+    }
+    size_t panel_cap = (max_nnz < PRED_CSR_PANEL_CAP)?
+                        max_nnz : PRED_CSR_PANEL_CAP;
+
+    real_t *restrict panels = NULL;
+    if (panel_cap >= PRED_CSR_MIN_PANEL)
+        panels = (real_t*)malloc((size_t)nthreads * panel_cap
+                                  * k_szt * sizeof(real_t));
+
+    #pragma omp parallel for schedule(dynamic) num_threads(nthreads) \
+            shared(out, A, B, Xr_indptr, Xr_indices, dimA, k, k_szt, \
+                   panels, panel_cap)
+    for (row = 0; row < dimA; row++)
+    {
+        size_t st = Xr_indptr[row];
+        size_t nnz_this = Xr_indptr[row + 1] - st;
+        if (nnz_this == 0) continue;
+
+        if (panels != NULL &&
+            nnz_this >= PRED_CSR_MIN_PANEL && nnz_this <= panel_cap)
+        {
+            real_t *restrict panel = panels
+                                      + (size_t)omp_get_thread_num()
+                                         * panel_cap * k_szt;
+            for (size_t ix = 0; ix < nnz_this; ix++)
+                memcpy(panel + ix*k_szt,
+                       B + (size_t)Xr_indices[st + ix]*k_szt,
+                       k_szt*sizeof(real_t));
+            cblas_tgemv(CblasRowMajor, CblasNoTrans,
+                        (int)nnz_this, k,
+                        1., panel, k,
+                        A + (size_t)row*k_szt, 1,
+                        0., out + st, 1);
+        }
+        else {
+            for (size_t ix = 0; ix < nnz_this; ix++)
+                out[st + ix] = cblas_tdot(k, A + (size_t)row*k_szt, 1,
+                                          B + (size_t)Xr_indices[st + ix]*k_szt, 1);
+        }
+    }
+
+    free(panels);
+}
+
 long double eval_llk
 (
     real_t *restrict A,
@@ -78,12 +158,18 @@ long double eval_llk
 {
     #if defined(_OPENMP) && ((_OPENMP < 200801) || defined(_WIN32) || defined(_WIN64))
     long long ix = 0;
+    long long strip = 0;
     #else
     size_t ix = 0;
+    size_t strip = 0;
     #endif
-    real_t pred;
     size_t k_szt = (size_t)k;
     long double llk = 0;
+    /*  The log calls are batched: each thread computes a strip of
+        predictions into a small buffer, applies the vectorized log over
+        the strip, and then accumulates - one libm call per non-zero would
+        otherwise dominate this function. */
+    size_t n_strips = (nnz + POISMF_LOG_STRIP - 1) / POISMF_LOG_STRIP;
 
     real_t *restrict sumA = NULL;
     real_t *restrict sumB = NULL;
@@ -91,12 +177,20 @@ long double eval_llk
     if (!include_missing)
     {
         #pragma omp parallel for schedule(static) num_threads(nthreads) \
-                reduction(+:llk) private(pred) shared(A, B, ixA, ixB, k, k_szt, X, nnz)
-        for (ix = 0; ix < nnz; ix++)
+                reduction(+:llk) shared(A, B, ixA, ixB, k, k_szt, X, nnz, n_strips)
+        for (strip = 0; strip < n_strips; strip++)
         {
-            pred = cblas_tdot(k, A + (size_t)ixA[ix] * k_szt, 1,
-                                 B + (size_t)ixB[ix] * k_szt, 1);
-            llk += X[ix] * log(pred) - pred;
+            real_t preds[POISMF_LOG_STRIP];
+            real_t logs[POISMF_LOG_STRIP];
+            size_t st = (size_t)strip * POISMF_LOG_STRIP;
+            size_t n_this = nnz - st;
+            n_this = (n_this > POISMF_LOG_STRIP)? POISMF_LOG_STRIP : n_this;
+            for (size_t i = 0; i < n_this; i++)
+                preds[i] = cblas_tdot(k, A + (size_t)ixA[st + i] * k_szt, 1,
+                                         B + (size_t)ixB[st + i] * k_szt, 1);
+            poismf_vlog(preds, logs, n_this);
+            for (size_t i = 0; i < n_this; i++)
+                llk += X[st + i] * logs[i] - preds[i];
         }
     }
 
@@ -110,13 +204,24 @@ long double eval_llk
             goto cleanup;
         }
 
-        sum_by_cols(sumA, A, dimA, k_szt);
-        sum_by_cols(sumB, B, dimB, k_szt);
+        sum_by_cols_parallel(sumA, A, dimA, k_szt, nthreads);
+        sum_by_cols_parallel(sumB, B, dimB, k_szt, nthreads);
         #pragma omp parallel for schedule(static) num_threads(nthreads) \
-                reduction(+:llk) shared(X, nnz, A, B, ixA, ixB, k, k_szt)
-        for (ix = 0; ix < nnz; ix++)
-            llk += X[ix] * log(cblas_tdot(k, A + (size_t)ixA[ix] * k_szt, 1,
-                                             B + (size_t)ixB[ix] * k_szt, 1));
+                reduction(+:llk) shared(X, nnz, A, B, ixA, ixB, k, k_szt, n_strips)
+        for (strip = 0; strip < n_strips; strip++)
+        {
+            real_t preds[POISMF_LOG_STRIP];
+            real_t logs[POISMF_LOG_STRIP];
+            size_t st = (size_t)strip * POISMF_LOG_STRIP;
+            size_t n_this = nnz - st;
+            n_this = (n_this > POISMF_LOG_STRIP)? POISMF_LOG_STRIP : n_this;
+            for (size_t i = 0; i < n_this; i++)
+                preds[i] = cblas_tdot(k, A + (size_t)ixA[st + i] * k_szt, 1,
+                                         B + (size_t)ixB[st + i] * k_szt, 1);
+            poismf_vlog(preds, logs, n_this);
+            for (size_t i = 0; i < n_this; i++)
+                llk += X[st + i] * logs[i];
+        }
         llk -= cblas_tdot(k, sumA, 1, sumB, 1);
     }
 
@@ -213,7 +318,7 @@ int factors_multiple
     }
 
     /* Initialize all values to the mean of old A */
-    sum_by_cols(A, A_old, dimA, k_szt);
+    sum_by_cols_parallel(A, A_old, dimA, k_szt, nthreads);
     cblas_tscal(k, 1./(real_t)dimA, A, 1);
     #pragma omp parallel for schedule(static) num_threads(nthreads) \
             shared(dimA, A, k_szt)
@@ -235,8 +340,8 @@ int factors_multiple
                 }
                 cnst_div = 1. / (1. + 2. * l2_reg * step_size);
                 pg_iteration(A, B, Xr, Xr_indptr, Xr_indices,
-                             dimA, k, cnst_div, Bsum_scaled, Bsum_w_scaled,
-                             step_size, w_mult, maxupd, buffer_arr, nthreads);
+                             dimA, k, NULL, NULL, cnst_div, Bsum_scaled, Bsum_w_scaled,
+                             step_size, w_mult, maxupd, buffer_arr, NULL, nthreads);
                 step_size *= 0.5;
             }
             break;
@@ -245,19 +350,21 @@ int factors_multiple
         case cg:
         {
             cg_iteration(A, B, Xr, Xr_indptr, Xr_indices,
-                         dimA, k_szt, limit_step,
+                         dimA, k_szt, NULL, NULL, limit_step,
                          Bsum, l2_reg, w_mult, maxupd * niter,
-                         buffer_arr, Bsum_w, nthreads);
+                         buffer_arr, Bsum_w, NULL, nthreads);
             break;
         }
 
         case tncg:
         {
             tncg_iteration(A, B, Xr, Xr_indptr, Xr_indices,
-                           dimA, k_szt, Bsum, l2_reg, w_mult, maxupd,
+                           dimA, k_szt, NULL, NULL, Bsum, l2_reg, w_mult, maxupd,
                            buffer_arr, buffer_int,
                            zeros_tncg, inf_tncg,
-                           Bsum_w, nthreads);
+                           Bsum_w,
+                           NULL, 0, 0,
+                           NULL, nthreads);
             break;
         }
     }
@@ -294,7 +401,7 @@ int factors_single
     real_t *restrict inf_tncg = (real_t*)malloc(sizeof(real_t) * k);
     int ret_code = 0;
 
-    fdata data = { B, NULL, X, X_ind, nnz, l2_reg, w_mult, k_int };
+    fdata data = { B, NULL, X, X_ind, NULL, nnz, l2_reg, w_mult, k_int };
     real_t fun_val = 0;
     int niter = 0;
     int nfeval = 0;
@@ -367,3 +474,525 @@ int factors_single
         free(inf_tncg);
         return ret_code;
 }
+
+/*  Reusable context for repeated calls to 'factors_single'.
+
+    'factors_single' is meant to be called on every request when folding-in
+    new users online, yet each call allocates the solver workspaces anew
+    (plus whatever 'tnc' allocates internally when passed NULL buffers), and
+    re-scans the entire old A matrix just to build the warm start. At high
+    request rates both of those dominate the latency of the actual solve.
+    The context below pre-allocates every buffer once, caches the column
+    means of the old A matrix and the 'Bsum' vector, and is then used through
+    'factors_single_ctx', which performs no allocations at all.
+
+    The context is NOT thread-safe: concurrent requests should each hold
+    their own (they are cheap once initialized - everything scales with 'k'
+    only, except for the optional packed copy of B below). If A or B change
+    (e.g. after a re-fit), initialize a new context.
+
+    When 'pack_B' is passed, the context additionally keeps a
+    blocked-interleaved copy of B (see 'poismf_pack_B') and the solves read
+    that instead of gathering random B rows - item-factor gathers being the
+    dominant memory traffic of a fold-in. It costs one extra B worth of
+    memory per context, so concurrent contexts against the same model may
+    prefer to share one externally-packed buffer through 'fdata' instead.
+    Returns 0 on success, 1 on out-of-memory. */
+int poismf_foldin_ctx_init
+(
+    poismf_foldin_ctx *restrict ctx,
+    real_t *restrict B, real_t *restrict Bsum,
+    real_t *restrict A_old, size_t dimA, size_t dimB,
+    size_t k, bool pack_B
+)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->k = k;
+    ctx->B = B;
+
+    ctx->Bsum = (real_t*)malloc(sizeof(real_t) * k);
+    ctx->a_mean = (real_t*)malloc(sizeof(real_t) * k);
+    ctx->Bsum_pass = (real_t*)malloc(sizeof(real_t) * k);
+    ctx->zeros_tncg = (real_t*)calloc(sizeof(real_t), k);
+    ctx->inf_tncg = (real_t*)malloc(sizeof(real_t) * k);
+    ctx->buffer_arr = (real_t*)malloc(sizeof(real_t) * (size_t)22 * k);
+    ctx->buffer_int = (int*)malloc(sizeof(int) * k);
+    if (ctx->Bsum == NULL || ctx->a_mean == NULL || ctx->Bsum_pass == NULL ||
+        ctx->zeros_tncg == NULL || ctx->inf_tncg == NULL ||
+        ctx->buffer_arr == NULL || ctx->buffer_int == NULL)
+    {
+        throw_oom:
+        fprintf(stderr, "Error: out of memory.\n");
+        poismf_foldin_ctx_free(ctx);
+        return 1;
+    }
+
+    if (pack_B) {
+        size_t n_blocks = (dimB + POISMF_PACK_WIDTH - 1) / POISMF_PACK_WIDTH;
+        ctx->B_pack = (real_t*)malloc(sizeof(real_t) * n_blocks
+                                                     * POISMF_PACK_WIDTH * k);
+        if (ctx->B_pack == NULL) goto throw_oom;
+        poismf_pack_B(B, dimB, k, ctx->B_pack);
+    }
+
+    memcpy(ctx->Bsum, Bsum, sizeof(real_t) * k);
+    for (size_t ix = 0; ix < k; ix++)
+        ctx->inf_tncg[ix] = HUGE_VAL;
+
+    /* Cached warm start: mean of the existing factors */
+    sum_by_cols(ctx->a_mean, A_old, dimA, k);
+    cblas_tscal((int)k, 1./(real_t)dimA, ctx->a_mean, 1);
+    return 0;
+}
+
+void poismf_foldin_ctx_free(poismf_foldin_ctx *restrict ctx)
+{
+    free(ctx->Bsum);
+    free(ctx->a_mean);
+    free(ctx->Bsum_pass);
+    free(ctx->zeros_tncg);
+    free(ctx->inf_tncg);
+    free(ctx->buffer_arr);
+    free(ctx->buffer_int);
+    free(ctx->B_pack);
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+/* Allocation-free version of 'factors_single' working off a pre-initialized
+   context. Same semantics and return codes as 'factors_single' ('Bsum' given
+   at context initialization should already carry the *old* l1 regularization). */
+int factors_single_ctx
+(
+    real_t *restrict out,
+    poismf_foldin_ctx *restrict ctx,
+    real_t *restrict X, sparse_ix X_ind[], size_t nnz,
+    int maxupd, real_t l2_reg, real_t l1_new, real_t l1_old,
+    real_t w_mult
+)
+{
+    size_t k = ctx->k;
+    if (nnz == 0) {
+        memset(out, 0, k*sizeof(real_t));
+        return 0;
+    }
+
+    int k_int = (int) k;
+    real_t l1_reg = l1_new - l1_old;
+    real_t *restrict Bsum_pass;
+
+    fdata data = { ctx->B, NULL, X, X_ind, NULL, nnz, l2_reg, w_mult, k_int };
+    data.B_pack = ctx->B_pack;
+    real_t fun_val = 0;
+    int niter = 0;
+    int nfeval = 0;
+
+    if (l1_reg > 0. || w_mult != 1.)
+    {
+        Bsum_pass = ctx->Bsum_pass;
+
+        if (w_mult != 1.) {
+            memset(Bsum_pass, 0, sizeof(real_t) * k);
+            for (size_t ix = 0; ix < nnz; ix++)
+                cblas_taxpy(k_int, 1., ctx->B + X_ind[ix]*k, 1, Bsum_pass, 1);
+            cblas_tscal(k_int, w_mult - 1., Bsum_pass, 1);
+            cblas_taxpy(k_int, 1., ctx->Bsum, 1, Bsum_pass, 1);
+        }
+
+        else {
+            memcpy(Bsum_pass, ctx->Bsum, sizeof(real_t) * k);
+        }
+
+        if (l1_reg > 0.) {
+            for (size_t ix = 0; ix < k; ix++)
+                Bsum_pass[ix] += l1_reg;
+        }
+    }
+
+    else {
+        Bsum_pass = ctx->Bsum;
+    }
+
+    data.Bsum = Bsum_pass;
+
+    /* Warm start from the cached mean of the existing factors */
+    memcpy(out, ctx->a_mean, k*sizeof(real_t));
+
+    int ret_code = tnc(
+        k_int, out, &fun_val,
+        ctx->buffer_arr + (size_t)21*k,
+        calc_fun_and_grad,
+        (void*) &data, ctx->zeros_tncg, ctx->inf_tncg, (real_t*)NULL,
+        (real_t*)NULL, 0, -1, maxupd,
+        0.25, 10., 0., 0.,
+        1e-4, -1., -1., 1.3,
+        &nfeval, &niter,
+        ctx->buffer_arr, ctx->buffer_int);
+
+    if (ret_code == -3) {
+        fprintf(stderr, "Error: out of memory.\n");
+        return 1;
+    }
+    return 0;
+}
+
+/*  Latency-bounded fold-ins.
+
+    'factors_single' runs 'tnc' until 'maxupd' evaluations or its fixed
+    internal tolerances, so the time per call varies with how hard the row
+    is - an order of magnitude or more between easy and pathological rows.
+    The variants below take an explicit per-call budget (evaluations and/or
+    wall-clock time, checked after every objective evaluation) plus a
+    relative-improvement tolerance, return the best iterate seen when the
+    budget runs out, and report the projected-gradient norm achieved so a
+    caller can tell complete solves apart from truncated ones (e.g. to
+    queue the latter for asynchronous refinement). */
+
+/* Same as 'poismf_wtime' in poismf.c, which is private to that unit */
+static double foldin_wtime(void)
+{
+    #ifdef _OPENMP
+    return omp_get_wtime();
+    #else
+    return (double)clock() / (double)CLOCKS_PER_SEC;
+    #endif
+}
+
+typedef struct budget_eval_state {
+    fdata *base;
+    double deadline;        /* absolute wall time, 0 = none */
+    size_t max_nfeval;      /* 0 = none */
+    size_t nfeval;
+    double best_f;
+    real_t *best_x;         /* k entries, best iterate seen so far */
+    size_t k;
+    bool expired;
+} budget_eval_state;
+
+/*  Wraps 'calc_fun_and_grad' with the budget checks: 'tnc' stops the
+    minimization as soon as the evaluation returns non-zero, and since its
+    line searches evaluate trial points that may end up rejected, the best
+    point seen is tracked here so the caller can return it rather than
+    whatever the solver held when the budget struck. */
+static int calc_fun_and_grad_budgeted
+(
+    real_t *restrict x,
+    real_t *restrict f,
+    real_t *restrict grad,
+    void *data
+)
+{
+    budget_eval_state *st = (budget_eval_state*) data;
+    if (calc_fun_and_grad(x, f, grad, st->base))
+        return 1;
+    st->nfeval++;
+    if ((double)*f < st->best_f) {
+        st->best_f = *f;
+        memcpy(st->best_x, x, st->k*sizeof(real_t));
+    }
+    if ((st->max_nfeval != 0 && st->nfeval >= st->max_nfeval) ||
+        (st->deadline != 0 && foldin_wtime() >= st->deadline))
+    {
+        st->expired = true;
+        return 1;
+    }
+    return 0;
+}
+
+/*  Euclidean norm of the projected gradient at 'x' (components pointing
+    out of the non-negativity bound are dropped), spending one extra
+    objective evaluation. 'grad' is a k-length scratch buffer. */
+static double foldin_residual
+(
+    real_t *restrict x, fdata *restrict data,
+    real_t *restrict grad, double *restrict fun_val
+)
+{
+    real_t f = 0;
+    calc_fun_and_grad(x, &f, grad, data);
+    double sq = 0;
+    double g;
+    for (size_t ix = 0; ix < (size_t)data->k; ix++) {
+        g = grad[ix];
+        if (x[ix] <= 0. && g > 0.) g = 0.;
+        sq += g*g;
+    }
+    *fun_val = f;
+    return sqrt(sq);
+}
+
+/*  'factors_single' with a budget. Inputs are as in 'factors_single';
+    'budget' configures the caps (see its definition in poismf.h) and gets
+    its output fields filled regardless of how the solve ended. A positive
+    'rel_tol' replaces the fixed f-improvement tolerance passed to 'tnc'.
+    Returns 0 on success (including truncated solves) and 1 on OOM. */
+int factors_single_bounded
+(
+    real_t *restrict out, size_t k,
+    real_t *restrict A_old, size_t dimA,
+    real_t *restrict X, sparse_ix X_ind[], size_t nnz,
+    real_t *restrict B, real_t *restrict Bsum,
+    int maxupd, real_t l2_reg, real_t l1_new, real_t l1_old,
+    real_t w_mult,
+    poismf_foldin_budget *restrict budget
+)
+{
+    budget->complete = true;
+    budget->nfeval = 0;
+    budget->fun_val = 0;
+    budget->residual = 0;
+    if (nnz == 0) {
+        memset(out, 0, k*sizeof(real_t));
+        return 0;
+    }
+
+    double time_st = foldin_wtime();
+    int k_int = (int) k;
+    real_t l1_reg = l1_new - l1_old;
+    real_t *restrict Bsum_pass = NULL;
+    real_t *restrict zeros_tncg = (real_t*)calloc(sizeof(real_t), k);
+    real_t *restrict inf_tncg = (real_t*)malloc(sizeof(real_t) * k);
+    real_t *restrict best_x = (real_t*)malloc(sizeof(real_t) * (size_t)2 * k);
+    real_t *restrict res_grad = best_x + k;
+    int ret_code = 0;
+
+    fdata data = { B, NULL, X, X_ind, NULL, nnz, l2_reg, w_mult, k_int };
+    real_t fun_val = 0;
+    int niter = 0;
+    int nfeval = 0;
+
+    if (zeros_tncg == NULL || inf_tncg == NULL || best_x == NULL)
+        goto throw_oom;
+
+    if (l1_reg > 0. || w_mult != 1.)
+    {
+        Bsum_pass = (real_t*)malloc(sizeof(real_t) * k);
+        if (Bsum_pass == NULL) {
+            throw_oom:
+                fprintf(stderr, "Error: out of memory.\n");
+                ret_code = 1;
+                goto cleanup;
+        }
+
+        if (w_mult != 1.) {
+            memset(Bsum_pass, 0, sizeof(real_t) * k);
+            for (size_t ix = 0; ix < nnz; ix++)
+                cblas_taxpy(k_int, 1., B + X_ind[ix]*k, 1, Bsum_pass, 1);
+            cblas_tscal(k_int, w_mult - 1., Bsum_pass, 1);
+            cblas_taxpy(k_int, 1., Bsum, 1, Bsum_pass, 1);
+        }
+
+        else {
+            memcpy(Bsum_pass, Bsum, sizeof(real_t) * k);
+        }
+
+        if (l1_reg > 0.) {
+            for (size_t ix = 0; ix < k; ix++)
+                Bsum_pass[ix] += l1_reg;
+        }
+    }
+
+    else {
+        Bsum_pass = Bsum;
+    }
+
+    data.Bsum = Bsum_pass;
+
+    for (size_t ix = 0; ix < k; ix++)
+        inf_tncg[ix] = HUGE_VAL;
+
+    /* Initialize to the mean of current factors */
+    sum_by_cols(out, A_old, dimA, k);
+    cblas_tscal((int)k, 1./(real_t)dimA, out, 1);
+
+    budget_eval_state st = {
+        &data,
+        (budget->max_seconds > 0.)? (time_st + budget->max_seconds) : 0.,
+        budget->max_nfeval,
+        0, HUGE_VAL, best_x, k, false
+    };
+
+    ret_code = tnc(
+        k_int, out, &fun_val,
+        (real_t*)NULL,
+        calc_fun_and_grad_budgeted,
+        (void*) &st, zeros_tncg, inf_tncg, (real_t*)NULL,
+        (real_t*)NULL, 0, -1, maxupd,
+        0.25, 10., 0., 0.,
+        (budget->rel_tol > 0.)? budget->rel_tol : (real_t)1e-4, -1., -1., 1.3,
+        &nfeval, &niter,
+        (real_t*)NULL, (int*)NULL);
+
+    if (ret_code == -3) {
+        goto throw_oom;
+    }
+
+    if (st.expired && st.best_f < (double)fun_val)
+        memcpy(out, best_x, k*sizeof(real_t));
+
+    budget->nfeval = st.nfeval;
+    budget->complete = !st.expired &&
+                       (ret_code == 0 || ret_code == 1 || ret_code == 2);
+    budget->residual = foldin_residual(out, &data, res_grad,
+                                       &budget->fun_val);
+    ret_code = 0;
+
+    cleanup:
+        if (l1_reg > 0. || w_mult != 1.)
+            free(Bsum_pass);
+        free(zeros_tncg);
+        free(inf_tncg);
+        free(best_x);
+        return ret_code;
+}
+
+/*  Batch counterpart: solves every row of A under the same budget rules
+    (the 'tncg' per-row solver only - the pg/cg paths of
+    'factors_multiple' have no notion of per-row evaluations to cap).
+    'max_nfeval' and 'rel_tol' apply per row; 'max_seconds' is a deadline
+    for the whole call, so rows reaching it are left at their warm start
+    and reported as incomplete. On output, 'nfeval' totals all rows,
+    'fun_val' is the summed objective, 'residual' the worst per-row
+    projected-gradient norm, and 'complete' is false if any row was cut
+    short. Returns 0 on success, 1 on OOM. */
+int factors_multiple_bounded
+(
+    real_t *A, real_t *B, real_t *A_old, real_t *Bsum,
+    real_t *Xr, sparse_ix *Xr_indptr, sparse_ix *Xr_indices,
+    int k, size_t dimA,
+    real_t l2_reg, real_t w_mult,
+    size_t maxupd,
+    poismf_foldin_budget *restrict budget,
+    int nthreads
+)
+{
+    #if defined(_OPENMP) && ((_OPENMP < 200801) || defined(_WIN32) || defined(_WIN64))
+    long long row = 0;
+    #else
+    size_t row = 0;
+    #endif
+
+    budget->complete = true;
+    budget->nfeval = 0;
+    budget->fun_val = 0;
+    budget->residual = 0;
+
+    double time_st = foldin_wtime();
+    double deadline = (budget->max_seconds > 0.)?
+                        (time_st + budget->max_seconds) : 0.;
+    size_t k_szt = (size_t) k;
+    int return_val = 0;
+    uint64_t nfeval_total = 0;
+    uint64_t n_incomplete = 0;
+    double fun_total = 0;
+
+    /* per-thread: 21k tnc buffer + best_x + residual scratch
+       (+ row Bsum for weighted fits), plus shared bound arrays */
+    size_t per_thread = (size_t)23 + (w_mult != 1.);
+    real_t *restrict buffer_arr = (real_t*)malloc(sizeof(real_t) * per_thread
+                                                  * k_szt * (size_t)nthreads);
+    int *restrict buffer_int = (int*)malloc(sizeof(int) * k_szt
+                                                        * (size_t)nthreads);
+    real_t *restrict zeros_tncg = (real_t*)calloc(sizeof(real_t), k_szt);
+    real_t *restrict inf_tncg = (real_t*)malloc(sizeof(real_t) * k_szt);
+    double *restrict res_partial = (double*)calloc(sizeof(double),
+                                                   (size_t)nthreads);
+    if (buffer_arr == NULL || buffer_int == NULL || zeros_tncg == NULL ||
+        inf_tncg == NULL || res_partial == NULL)
+    {
+        fprintf(stderr, "Error: out of memory.\n");
+        return_val = 1;
+        goto cleanup;
+    }
+    for (size_t ix = 0; ix < k_szt; ix++)
+        inf_tncg[ix] = HUGE_VAL;
+
+    /* Initialize all values to the mean of old A */
+    sum_by_cols_parallel(A, A_old, dimA, k_szt, nthreads);
+    cblas_tscal(k, 1./(real_t)dimA, A, 1);
+    #pragma omp parallel for schedule(static) num_threads(nthreads) \
+            shared(dimA, A, k_szt)
+    for (row = 1; row < dimA; row++)
+        memcpy(A + (size_t)row*k_szt, A, k_szt*sizeof(real_t));
+
+    #pragma omp parallel for schedule(dynamic) num_threads(nthreads) \
+            shared(A, B, Bsum, Xr, Xr_indptr, Xr_indices, dimA, k, k_szt, \
+                   l2_reg, w_mult, maxupd, deadline, budget, \
+                   buffer_arr, buffer_int, zeros_tncg, inf_tncg, \
+                   res_partial, per_thread) \
+            reduction(+:nfeval_total) reduction(+:n_incomplete) \
+            reduction(+:fun_total)
+    for (row = 0; row < dimA; row++)
+    {
+        size_t nnz_this = Xr_indptr[row + 1] - Xr_indptr[row];
+        if (nnz_this == 0) {
+            memset(A + (size_t)row*k_szt, 0, k_szt*sizeof(real_t));
+            continue;
+        }
+
+        int tid = omp_get_thread_num();
+        real_t *restrict tnc_buffer = buffer_arr
+                                       + (size_t)tid * per_thread * k_szt;
+        real_t *restrict best_x = tnc_buffer + (size_t)21*k_szt;
+        real_t *restrict res_grad = best_x + k_szt;
+        real_t *restrict a_row = A + (size_t)row*k_szt;
+
+        fdata data = { B, Bsum,
+                       Xr + Xr_indptr[row], Xr_indices + Xr_indptr[row],
+                       NULL, nnz_this, l2_reg, w_mult, k };
+        if (w_mult != 1.) {
+            real_t *restrict Bsum_row = res_grad + k_szt;
+            memset(Bsum_row, 0, k_szt*sizeof(real_t));
+            for (size_t ix = Xr_indptr[row]; ix < Xr_indptr[row + 1]; ix++)
+                cblas_taxpy(k, 1., B + Xr_indices[ix]*k_szt, 1, Bsum_row, 1);
+            cblas_tscal(k, w_mult - 1., Bsum_row, 1);
+            cblas_taxpy(k, 1., Bsum, 1, Bsum_row, 1);
+            data.Bsum = Bsum_row;
+        }
+
+        budget_eval_state st = {
+            &data, deadline, budget->max_nfeval,
+            0, HUGE_VAL, best_x, k_szt, false
+        };
+        real_t fun_val = 0;
+        int niter = 0;
+        int nfeval = 0;
+
+        int rc = tnc(
+            k, a_row, &fun_val,
+            (real_t*)NULL,
+            calc_fun_and_grad_budgeted,
+            (void*) &st, zeros_tncg, inf_tncg, (real_t*)NULL,
+            (real_t*)NULL, 0, -1, (int)maxupd,
+            0.25, 10., 0., 0.,
+            (budget->rel_tol > 0.)? budget->rel_tol : (real_t)1e-4,
+            -1., -1., 1.3,
+            &nfeval, &niter,
+            tnc_buffer, buffer_int + (size_t)tid*k_szt);
+
+        if (st.expired && st.best_f < (double)fun_val)
+            memcpy(a_row, best_x, k_szt*sizeof(real_t));
+
+        double f_row;
+        double res = foldin_residual(a_row, &data, res_grad, &f_row);
+        nfeval_total += (uint64_t)st.nfeval;
+        fun_total += f_row;
+        n_incomplete += st.expired || !(rc == 0 || rc == 1 || rc == 2);
+        if (res > res_partial[tid])
+            res_partial[tid] = res;
+    }
+
+    budget->nfeval = (size_t)nfeval_total;
+    budget->fun_val = fun_total;
+    budget->complete = (n_incomplete == 0);
+    for (int tid = 0; tid < nthreads; tid++)
+        if (res_partial[tid] > budget->residual)
+            budget->residual = res_partial[tid];
+
+    cleanup:
+        free(buffer_arr);
+        free(buffer_int);
+        free(zeros_tncg);
+        free(inf_tncg);
+        free(res_partial);
+    return return_val;
+}
@@ -83,6 +83,18 @@ void cblas_dgemv(const CBLAS_ORDER order,  const CBLAS_TRANSPOSE TransA,  const
         dgemv_(&trans, &n, &m, &alpha, a, &lda, x, &incx, &beta, y, &incy);
     }
 }
+void cblas_dgemm(const CBLAS_ORDER Order, const CBLAS_TRANSPOSE TransA, const CBLAS_TRANSPOSE TransB,
+     const int M, const int N, const int K,
+     const double alpha, const double *A, const int lda, const double *B, const int ldb,
+     const double beta, double *C, const int ldc)
+{
+    char transA = (TransA == CblasNoTrans)? 'N' : 'T';
+    char transB = (TransB == CblasNoTrans)? 'N' : 'T';
+    if (Order == CblasColMajor)
+        dgemm_(&transA, &transB, &M, &N, &K, &alpha, A, &lda, B, &ldb, &beta, C, &ldc);
+    else
+        dgemm_(&transB, &transA, &N, &M, &K, &alpha, B, &ldb, A, &lda, &beta, C, &ldc);
+}
 
 SEXP wrapper_run_poismf
 (
@@ -256,6 +268,239 @@ SEXP wrapper_topN
     return R_NilValue;
 }
 
+/*  External-pointer model handles. The classic wrappers above receive the
+    factor matrices as R vectors, so every fit and every serve call drags
+    multi-GB REALSXP copies through the R heap. A handle instead keeps A
+    and B in native memory (malloc'd, or mmapped straight from a saved
+    model file), wrapped in an EXTPTRSXP with a finalizer; the fit and
+    serving wrappers below operate on the handle in place, and R-side
+    copies only ever materialize through the explicit export function. */
+typedef struct poismf_r_model {
+    double *A;
+    double *B;
+    size_t dimA, dimB, k;
+    poismf_mmap_model mapped;
+    bool is_mapped;    /* factors point into a read-only file mapping */
+} poismf_r_model;
+
+static void poismf_model_finalizer(SEXP ext)
+{
+    poismf_r_model *model = (poismf_r_model*) R_ExternalPtrAddr(ext);
+    if (model == NULL) return;
+    if (model->is_mapped)
+        poismf_mmap_unload(&model->mapped);
+    else {
+        free(model->A);
+        free(model->B);
+    }
+    free(model);
+    R_ClearExternalPtr(ext);
+}
+
+static poismf_r_model* get_model_handle(SEXP ext)
+{
+    if (TYPEOF(ext) != EXTPTRSXP)
+        Rf_error("Model handle is not an external pointer.");
+    poismf_r_model *model = (poismf_r_model*) R_ExternalPtrAddr(ext);
+    if (model == NULL)
+        Rf_error("Model handle is invalid or already freed.");
+    return model;
+}
+
+static SEXP wrap_model_handle(poismf_r_model *model)
+{
+    SEXP ext = PROTECT(R_MakeExternalPtr(model, R_NilValue, R_NilValue));
+    R_RegisterCFinalizerEx(ext, poismf_model_finalizer, TRUE);
+    UNPROTECT(1);
+    return ext;
+}
+
+/* Fresh handle with randomly-initialized factors (same initialization
+   as 'large_rnd_vec', drawn without leaving native memory) */
+SEXP wrapper_model_new
+(
+    SEXP dimA, SEXP dimB, SEXP k,
+    SEXP do_gamma
+)
+{
+    size_t dimA_szt = (size_t) Rf_asInteger(dimA);
+    size_t dimB_szt = (size_t) Rf_asInteger(dimB);
+    size_t k_szt = (size_t) Rf_asInteger(k);
+    poismf_r_model *model = (poismf_r_model*)calloc(1, sizeof(poismf_r_model));
+    if (model == NULL) Rf_error("Out of memory.");
+    model->A = (double*)malloc(dimA_szt*k_szt*sizeof(double));
+    model->B = (double*)malloc(dimB_szt*k_szt*sizeof(double));
+    if (model->A == NULL || model->B == NULL) {
+        free(model->A); free(model->B); free(model);
+        Rf_error("Out of memory.");
+    }
+    model->dimA = dimA_szt;
+    model->dimB = dimB_szt;
+    model->k = k_szt;
+
+    GetRNGstate();
+    for (size_t ix = 0; ix < dimA_szt*k_szt; ix++)
+        model->A[ix] = unif_rand();
+    for (size_t ix = 0; ix < dimB_szt*k_szt; ix++)
+        model->B[ix] = unif_rand();
+    PutRNGstate();
+    if (Rf_asLogical(do_gamma)) {
+        for (size_t ix = 0; ix < dimA_szt*k_szt; ix++)
+            model->A[ix] = -log(model->A[ix]);
+        for (size_t ix = 0; ix < dimB_szt*k_szt; ix++)
+            model->B[ix] = -log(model->B[ix]);
+    }
+    return wrap_model_handle(model);
+}
+
+/* Handle over a model file written by 'wrapper_model_save' - the factors
+   are mmapped, so opening a 50GB model costs no memory up front. Mapped
+   handles are read-only: they serve, but cannot be fit further. */
+SEXP wrapper_model_from_file(SEXP path)
+{
+    poismf_r_model *model = (poismf_r_model*)calloc(1, sizeof(poismf_r_model));
+    if (model == NULL) Rf_error("Out of memory.");
+    if (poismf_mmap_load(CHAR(STRING_ELT(path, 0)), &model->mapped)) {
+        free(model);
+        Rf_error("Could not load model file.");
+    }
+    model->A = model->mapped.A;
+    model->B = model->mapped.B;
+    model->dimA = model->mapped.dimA;
+    model->dimB = model->mapped.dimB;
+    model->k = model->mapped.k;
+    model->is_mapped = true;
+    return wrap_model_handle(model);
+}
+
+SEXP wrapper_model_save(SEXP ext, SEXP path)
+{
+    poismf_r_model *model = get_model_handle(ext);
+    if (poismf_save(CHAR(STRING_ELT(path, 0)),
+                    model->A, model->B,
+                    model->dimA, model->dimB, model->k))
+        Rf_error("Could not save model file.");
+    return R_NilValue;
+}
+
+SEXP wrapper_model_dims(SEXP ext)
+{
+    poismf_r_model *model = get_model_handle(ext);
+    SEXP out = PROTECT(Rf_allocVector(REALSXP, 3));
+    REAL(out)[0] = (double)model->dimA;
+    REAL(out)[1] = (double)model->dimB;
+    REAL(out)[2] = (double)model->k;
+    UNPROTECT(1);
+    return out;
+}
+
+/* The one deliberate copy: materializes A ('which' = 0) or B (1) as an
+   R vector for users who want the factors as a matrix */
+SEXP wrapper_model_export(SEXP ext, SEXP which)
+{
+    poismf_r_model *model = get_model_handle(ext);
+    bool want_A = Rf_asInteger(which) == 0;
+    size_t dim = want_A? model->dimA : model->dimB;
+    SEXP out = PROTECT(Rf_allocVector(REALSXP, (R_xlen_t)(dim * model->k)));
+    memcpy(REAL(out), want_A? model->A : model->B,
+           dim * model->k * sizeof(double));
+    UNPROTECT(1);
+    return out;
+}
+
+/* Same fit as 'wrapper_run_poismf', updating the handle's factors in
+   place - the sparse data still comes in as R vectors, but no factor
+   copies are made on either side of the call */
+SEXP wrapper_model_run_poismf
+(
+    SEXP ext,
+    SEXP Xr, SEXP Xr_indices, SEXP Xr_indptr,
+    SEXP Xc, SEXP Xc_indices, SEXP Xc_indptr,
+    SEXP method, SEXP limit_step,
+    SEXP l2_reg, SEXP l1_reg,
+    SEXP w_mult, SEXP step_size,
+    SEXP niter, SEXP maxupd,
+    SEXP handle_interrupt, SEXP nthreads
+)
+{
+    poismf_r_model *model = get_model_handle(ext);
+    if (model->is_mapped)
+        Rf_error("Cannot fit a model loaded from file (read-only mapping).");
+    if (Rf_xlength(Xr) == 0) {
+        Rf_error("'X' contains no non-zero entries.");
+        return R_NilValue;
+    }
+    int ret_code = run_poismf(
+        model->A, REAL(Xr), INTEGER(Xr_indptr), INTEGER(Xr_indices),
+        model->B, REAL(Xc), INTEGER(Xc_indptr), INTEGER(Xc_indices),
+        model->dimA, model->dimB, model->k,
+        Rf_asReal(l2_reg), Rf_asReal(l1_reg),
+        Rf_asReal(w_mult), Rf_asReal(step_size),
+        (Method) Rf_asInteger(method), (bool) Rf_asLogical(limit_step),
+        (size_t) Rf_asInteger(niter), (size_t) Rf_asInteger(maxupd),
+        (bool) Rf_asLogical(handle_interrupt), Rf_asInteger(nthreads)
+    );
+    if (ret_code == 1) Rf_error("Out of memory.");
+    return R_NilValue;
+}
+
+SEXP wrapper_model_predict_multiple
+(
+    SEXP ext,
+    SEXP ixA, SEXP ixB,
+    SEXP nthreads
+)
+{
+    poismf_r_model *model = get_model_handle(ext);
+    size_t nnz = (size_t) Rf_xlength(ixA);
+    SEXP out = PROTECT(Rf_allocVector(REALSXP, nnz));
+    predict_multiple(
+        REAL(out), model->A, model->B,
+        INTEGER(ixA), INTEGER(ixB),
+        nnz, (int)model->k,
+        Rf_asInteger(nthreads)
+    );
+    UNPROTECT(1);
+    return out;
+}
+
+/* Top-N from the handle's B; 'row' picks the query vector straight out
+   of the handle's A (zero-based; pass a negative row plus 'a_vec' to
+   rank an out-of-model vector instead) */
+SEXP wrapper_model_topN
+(
+    SEXP ext,
+    SEXP outp_ix, SEXP outp_score,
+    SEXP row, SEXP a_vec,
+    SEXP include_ix, SEXP exclude_ix,
+    SEXP top_n, SEXP nthreads
+)
+{
+    poismf_r_model *model = get_model_handle(ext);
+    int row_ix = Rf_asInteger(row);
+    if (row_ix >= 0 && (size_t)row_ix >= model->dimA)
+        Rf_error("Invalid 'row' for this model.");
+    double *a_ptr = (row_ix >= 0)?
+                     (model->A + (size_t)row_ix*model->k) : REAL(a_vec);
+    size_t n_include = (size_t) Rf_xlength(include_ix);
+    size_t n_exclude = (size_t) Rf_xlength(exclude_ix);
+    int res = topN(
+        a_ptr, model->B, (int)model->k,
+        n_include? INTEGER(include_ix) : (int*)NULL, n_include,
+        n_exclude? INTEGER(exclude_ix) : (int*)NULL, n_exclude,
+        INTEGER(outp_ix),
+        (Rf_xlength(outp_score) > 0)?
+            REAL(outp_score) : (double*)NULL,
+        (size_t) Rf_asInteger(top_n), model->dimB,
+        Rf_asInteger(nthreads)
+    );
+
+    if (res != 0)
+        Rf_error("Out of memory.");
+
+    return R_NilValue;
+}
+
 SEXP check_size_below_int_max
 (
     SEXP dim1, SEXP dim2
@@ -299,6 +544,14 @@ static const R_CallMethodDef callMethods [] = {
     {"wrapper_predict_factors_multiple", (DL_FUNC) &wrapper_predict_factors_multiple, 16},
     {"wrapper_eval_llk", (DL_FUNC) &wrapper_eval_llk, 11},
     {"wrapper_topN", (DL_FUNC) &wrapper_topN, 9},
+    {"wrapper_model_new", (DL_FUNC) &wrapper_model_new, 4},
+    {"wrapper_model_from_file", (DL_FUNC) &wrapper_model_from_file, 1},
+    {"wrapper_model_save", (DL_FUNC) &wrapper_model_save, 2},
+    {"wrapper_model_dims", (DL_FUNC) &wrapper_model_dims, 1},
+    {"wrapper_model_export", (DL_FUNC) &wrapper_model_export, 2},
+    {"wrapper_model_run_poismf", (DL_FUNC) &wrapper_model_run_poismf, 17},
+    {"wrapper_model_predict_multiple", (DL_FUNC) &wrapper_model_predict_multiple, 4},
+    {"wrapper_model_topN", (DL_FUNC) &wrapper_model_topN, 9},
     {"check_size_below_int_max", (DL_FUNC) &check_size_below_int_max, 2},
     {"large_rnd_vec", (DL_FUNC) &large_rnd_vec, 3},
     {NULL, NULL, 0}
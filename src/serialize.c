@@ -0,0 +1,341 @@
+ /*
+    Poisson Factorization for sparse matrices
+
+    Based on alternating proximal gradient iteration or conjugate gradient.
+    Variables must be initialized from outside the main function ('run_poismf').
+    Writen for C99 standard and OpenMP 2.0 or later.
+
+    Reference paper is:
+        Cortes, David.
+        "Fast Non-Bayesian Poisson Factorization for Implicit-Feedback Recommendations."
+        arXiv preprint arXiv:1811.01908 (2018).
+
+    BSD 2-Clause License
+
+    Copyright (c) 2020, David Cortes
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "poismf.h"
+#include <stdio.h>
+
+/*  Native binary model format.
+
+    The file starts with a fixed-size header recording the dimensions and the
+    floating point width, followed by the A and B factor matrices in row-major
+    order, each starting at a page-aligned offset. Because the factor blocks
+    are page-aligned, the file can be memory-mapped and the prediction
+    functions ('topN', 'predict_multiple', 'factors_single', etc.) can be
+    pointed directly at the mapped pages with no copy and no parsing -
+    cold-start time for serving becomes the time of a single 'mmap' call,
+    and the OS shares the pages between processes serving the same model. */
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #define POISMF_HAS_MMAP
+#endif
+
+static const char poismf_model_magic[8] = "POISMF\1\n";
+
+/* Factor blocks are aligned to this boundary regardless of the
+   actual page size of the machine that wrote the file */
+#define POISMF_MODEL_ALIGN ((size_t)4096)
+
+static size_t align_to_page(size_t offset)
+{
+    return (offset + (POISMF_MODEL_ALIGN-1)) & ~(POISMF_MODEL_ALIGN-1);
+}
+
+static int write_padding(FILE *f, size_t curr, size_t target)
+{
+    char zeros[256] = {0};
+    while (curr < target) {
+        size_t chunk = ((target - curr) < sizeof(zeros))?
+                        (target - curr) : sizeof(zeros);
+        if (fwrite(zeros, 1, chunk, f) != chunk) return 1;
+        curr += chunk;
+    }
+    return 0;
+}
+
+/* Saves already-fit A and B matrices into the binary model format.
+   Returns 0 on success, 1 on I/O failure. */
+int poismf_save
+(
+    const char *path,
+    real_t *restrict A, real_t *restrict B,
+    size_t dimA, size_t dimB, size_t k
+)
+{
+    poismf_model_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, poismf_model_magic, sizeof(header.magic));
+    header.fmt_version = 1;
+    header.real_width = (uint32_t)sizeof(real_t);
+    header.dimA = (uint64_t)dimA;
+    header.dimB = (uint64_t)dimB;
+    header.k = (uint64_t)k;
+    header.off_A = (uint64_t)align_to_page(sizeof(header));
+    header.off_B = (uint64_t)align_to_page((size_t)header.off_A
+                                           + dimA*k*sizeof(real_t));
+
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "Error: could not open file for writing.\n");
+        return 1;
+    }
+
+    int retval = 1;
+    if (fwrite(&header, sizeof(header), 1, f) != 1) goto cleanup;
+    if (write_padding(f, sizeof(header), (size_t)header.off_A)) goto cleanup;
+    if (fwrite(A, sizeof(real_t), dimA*k, f) != dimA*k) goto cleanup;
+    if (write_padding(f, (size_t)header.off_A + dimA*k*sizeof(real_t),
+                      (size_t)header.off_B)) goto cleanup;
+    if (fwrite(B, sizeof(real_t), dimB*k, f) != dimB*k) goto cleanup;
+    retval = 0;
+
+    cleanup:
+        if (retval == 1)
+            fprintf(stderr, "Error: failed to write model file.\n");
+        if (fclose(f) != 0) retval = 1;
+    return retval;
+}
+
+/*  Maps a saved model into memory, with 'out->A' / 'out->B' pointing straight
+    into the mapped pages (read-only, zero-copy). On platforms without 'mmap'
+    the factors are read into regular allocated memory instead, which behaves
+    the same but loses the instant-startup and page-sharing properties.
+    Returns 0 on success, 1 on I/O or memory failure, 2 if the file is not a
+    model file or was written with a different floating point width. */
+int poismf_mmap_load(const char *path, poismf_mmap_model *restrict out)
+{
+    memset(out, 0, sizeof(*out));
+    poismf_model_header header;
+
+    #ifdef POISMF_HAS_MMAP
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: could not open model file.\n");
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(header)) {
+        fprintf(stderr, "Error: invalid model file.\n");
+        close(fd);
+        return 2;
+    }
+
+    void *mapped = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); /* the mapping keeps its own reference */
+    if (mapped == MAP_FAILED) {
+        fprintf(stderr, "Error: could not memory-map model file.\n");
+        return 1;
+    }
+
+    memcpy(&header, mapped, sizeof(header));
+    if (memcmp(header.magic, poismf_model_magic, sizeof(header.magic)) != 0 ||
+        header.fmt_version != 1 ||
+        header.real_width != (uint32_t)sizeof(real_t) ||
+        (size_t)header.off_B + (size_t)header.dimB*(size_t)header.k*sizeof(real_t)
+            > (size_t)st.st_size)
+    {
+        fprintf(stderr, "Error: file is not a valid model file for this library build.\n");
+        munmap(mapped, (size_t)st.st_size);
+        return 2;
+    }
+
+    out->mem = mapped;
+    out->mem_size = (size_t)st.st_size;
+    out->owned = false;
+    out->A = (real_t*)((char*)mapped + header.off_A);
+    out->B = (real_t*)((char*)mapped + header.off_B);
+
+    #else
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Error: could not open model file.\n");
+        return 1;
+    }
+    if (fread(&header, sizeof(header), 1, f) != 1 ||
+        memcmp(header.magic, poismf_model_magic, sizeof(header.magic)) != 0 ||
+        header.fmt_version != 1 ||
+        header.real_width != (uint32_t)sizeof(real_t))
+    {
+        fprintf(stderr, "Error: file is not a valid model file for this library build.\n");
+        fclose(f);
+        return 2;
+    }
+
+    size_t n_A = (size_t)header.dimA * (size_t)header.k;
+    size_t n_B = (size_t)header.dimB * (size_t)header.k;
+    out->mem = malloc((n_A + n_B) * sizeof(real_t));
+    if (out->mem == NULL) {
+        fprintf(stderr, "Error: out of memory.\n");
+        fclose(f);
+        return 1;
+    }
+    out->mem_size = (n_A + n_B) * sizeof(real_t);
+    out->owned = true;
+    out->A = (real_t*)out->mem;
+    out->B = out->A + n_A;
+
+    if (fseek(f, (long)header.off_A, SEEK_SET) != 0 ||
+        fread(out->A, sizeof(real_t), n_A, f) != n_A ||
+        fseek(f, (long)header.off_B, SEEK_SET) != 0 ||
+        fread(out->B, sizeof(real_t), n_B, f) != n_B)
+    {
+        fprintf(stderr, "Error: failed to read model file.\n");
+        fclose(f);
+        free(out->mem);
+        memset(out, 0, sizeof(*out));
+        return 1;
+    }
+    fclose(f);
+    #endif
+
+    out->dimA = (size_t)header.dimA;
+    out->dimB = (size_t)header.dimB;
+    out->k = (size_t)header.k;
+    return 0;
+}
+
+/*  Checkpoint files for long training runs. A checkpoint is an ordinary
+    model file with a small footer recording how far training had gotten, so
+    an in-progress checkpoint can also be served directly through
+    'poismf_mmap_load'. The snapshot is written to a temporary name and
+    renamed into place, so a crash mid-write never clobbers the previous
+    checkpoint. */
+
+static const char poismf_ckpt_magic[8] = "POISMC\1\n";
+
+int poismf_checkpoint_save
+(
+    const char *path,
+    real_t *restrict A, real_t *restrict B,
+    size_t dimA, size_t dimB, size_t k,
+    uint64_t iter_done, double step_size
+)
+{
+    size_t len = strlen(path);
+    char *tmp_path = (char*)malloc(len + 5);
+    if (tmp_path == NULL) {
+        fprintf(stderr, "Error: out of memory.\n");
+        return 1;
+    }
+    memcpy(tmp_path, path, len);
+    memcpy(tmp_path + len, ".tmp", 5);
+
+    int retval = poismf_save(tmp_path, A, B, dimA, dimB, k);
+    if (retval != 0) goto cleanup;
+
+    poismf_checkpoint_footer footer;
+    memset(&footer, 0, sizeof(footer));
+    memcpy(footer.magic, poismf_ckpt_magic, sizeof(footer.magic));
+    footer.iter_done = iter_done;
+    footer.step_size = step_size;
+
+    FILE *f = fopen(tmp_path, "ab");
+    retval = 1;
+    if (f == NULL) goto failed_write;
+    if (fwrite(&footer, sizeof(footer), 1, f) != 1) {
+        fclose(f);
+        goto failed_write;
+    }
+    if (fclose(f) != 0) goto failed_write;
+
+    #if defined(_WIN32) || defined(_WIN64)
+    remove(path); /* 'rename' onto an existing file fails on Windows */
+    #endif
+    if (rename(tmp_path, path) != 0) goto failed_write;
+    retval = 0;
+    goto cleanup;
+
+    failed_write:
+        fprintf(stderr, "Error: failed to write checkpoint file.\n");
+        remove(tmp_path);
+    cleanup:
+        free(tmp_path);
+    return retval;
+}
+
+/*  Reads a checkpoint back into caller-allocated 'A' and 'B' (which must
+    match the recorded dimensions), along with the recorded progress.
+    Returns 0 on success, 1 on I/O or memory failure, 2 if the file is not
+    a checkpoint for this build or the dimensions do not match. */
+int poismf_checkpoint_load
+(
+    const char *path,
+    real_t *restrict A, real_t *restrict B,
+    size_t dimA, size_t dimB, size_t k,
+    uint64_t *restrict iter_done, double *restrict step_size
+)
+{
+    poismf_checkpoint_footer footer;
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Error: could not open checkpoint file.\n");
+        return 1;
+    }
+    if (fseek(f, -(long)sizeof(footer), SEEK_END) != 0 ||
+        fread(&footer, sizeof(footer), 1, f) != 1 ||
+        memcmp(footer.magic, poismf_ckpt_magic, sizeof(footer.magic)) != 0)
+    {
+        fprintf(stderr, "Error: file is not a valid checkpoint file.\n");
+        fclose(f);
+        return 2;
+    }
+    fclose(f);
+
+    poismf_mmap_model model;
+    int retval = poismf_mmap_load(path, &model);
+    if (retval != 0) return retval;
+    if (model.dimA != dimA || model.dimB != dimB || model.k != k) {
+        fprintf(stderr, "Error: checkpoint dimensions do not match.\n");
+        poismf_mmap_unload(&model);
+        return 2;
+    }
+
+    memcpy(A, model.A, dimA*k*sizeof(real_t));
+    memcpy(B, model.B, dimB*k*sizeof(real_t));
+    *iter_done = footer.iter_done;
+    *step_size = footer.step_size;
+    poismf_mmap_unload(&model);
+    return 0;
+}
+
+void poismf_mmap_unload(poismf_mmap_model *restrict out)
+{
+    if (out->mem != NULL) {
+        #ifdef POISMF_HAS_MMAP
+        if (!out->owned)
+            munmap(out->mem, out->mem_size);
+        else
+        #endif
+            free(out->mem);
+    }
+    memset(out, 0, sizeof(*out));
+}
@@ -0,0 +1,762 @@
+ /*
+    Poisson Factorization for sparse matrices
+
+    Based on alternating proximal gradient iteration or conjugate gradient.
+    Variables must be initialized from outside the main function ('run_poismf').
+    Writen for C99 standard and OpenMP 2.0 or later.
+
+    Reference paper is:
+        Cortes, David.
+        "Fast Non-Bayesian Poisson Factorization for Implicit-Feedback Recommendations."
+        arXiv preprint arXiv:1811.01908 (2018).
+
+    BSD 2-Clause License
+
+    Copyright (c) 2020, David Cortes
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "poismf.h"
+#if defined(POISMF_USE_MKL_VML)
+    #include <mkl_vml_functions.h>
+#endif
+
+/*  Fused kernels for the per-non-zero inner loops of the objective and
+    gradient calculations.
+
+    The vectors involved have length 'k' (typically 30-200), at which size a
+    call into BLAS 'dot'/'axpy' per non-zero entry is dominated by dispatch
+    overhead. The kernels here walk the non-zeros of a row once, computing
+    the prediction (dot product), the log-likelihood accumulation, and the
+    scaled gradient update in a single pass, with no external calls in the
+    loop body.
+
+    On x86, specialized versions compiled for AVX2+FMA and AVX-512 are
+    selected once at runtime according to what the CPU supports (the package
+    might be compiled on a different machine than the one running it). On
+    other architectures (e.g. ARM/NEON, POWER), the generic version is used,
+    which compilers are able to auto-vectorize for the native vector width. */
+
+#if !defined(POISMF_NO_SIMD) && \
+    (defined(__x86_64__) || defined(_M_X64)) && \
+    (defined(__clang__) || (defined(__GNUC__) && (__GNUC__ >= 6))) && \
+    !defined(_MSC_VER)
+    #define POISMF_X86_DISPATCH
+    #include <immintrin.h>
+#endif
+
+/* Generic building blocks - written so that compilers can vectorize them
+   for whatever instruction set the build targets */
+static real_t tdot_generic(const real_t *restrict x, const real_t *restrict y, const int k)
+{
+    real_t res = 0;
+    for (int ix = 0; ix < k; ix++)
+        res += x[ix] * y[ix];
+    return res;
+}
+
+static void taxpy_generic(const real_t alpha, const real_t *restrict x, real_t *restrict y, const int k)
+{
+    for (int ix = 0; ix < k; ix++)
+        y[ix] += alpha * x[ix];
+}
+
+#ifdef POISMF_X86_DISPATCH
+
+__attribute__((target("avx2,fma")))
+static real_t tdot_avx2(const real_t *restrict x, const real_t *restrict y, const int k)
+{
+    int ix = 0;
+    #ifndef USE_FLOAT
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    for (; ix + 8 <= k; ix += 8) {
+        acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(x + ix),     _mm256_loadu_pd(y + ix),     acc0);
+        acc1 = _mm256_fmadd_pd(_mm256_loadu_pd(x + ix + 4), _mm256_loadu_pd(y + ix + 4), acc1);
+    }
+    acc0 = _mm256_add_pd(acc0, acc1);
+    double tmp[4];
+    _mm256_storeu_pd(tmp, acc0);
+    real_t res = tmp[0] + tmp[1] + tmp[2] + tmp[3];
+    #else
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    for (; ix + 16 <= k; ix += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + ix),     _mm256_loadu_ps(y + ix),     acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + ix + 8), _mm256_loadu_ps(y + ix + 8), acc1);
+    }
+    acc0 = _mm256_add_ps(acc0, acc1);
+    float tmp[8];
+    _mm256_storeu_ps(tmp, acc0);
+    real_t res = tmp[0] + tmp[1] + tmp[2] + tmp[3]
+               + tmp[4] + tmp[5] + tmp[6] + tmp[7];
+    #endif
+    for (; ix < k; ix++)
+        res += x[ix] * y[ix];
+    return res;
+}
+
+__attribute__((target("avx2,fma")))
+static void taxpy_avx2(const real_t alpha, const real_t *restrict x, real_t *restrict y, const int k)
+{
+    int ix = 0;
+    #ifndef USE_FLOAT
+    __m256d valpha = _mm256_set1_pd(alpha);
+    for (; ix + 4 <= k; ix += 4)
+        _mm256_storeu_pd(y + ix,
+                         _mm256_fmadd_pd(valpha, _mm256_loadu_pd(x + ix),
+                                         _mm256_loadu_pd(y + ix)));
+    #else
+    __m256 valpha = _mm256_set1_ps(alpha);
+    for (; ix + 8 <= k; ix += 8)
+        _mm256_storeu_ps(y + ix,
+                         _mm256_fmadd_ps(valpha, _mm256_loadu_ps(x + ix),
+                                         _mm256_loadu_ps(y + ix)));
+    #endif
+    for (; ix < k; ix++)
+        y[ix] += alpha * x[ix];
+}
+
+__attribute__((target("avx512f")))
+static real_t tdot_avx512(const real_t *restrict x, const real_t *restrict y, const int k)
+{
+    int ix = 0;
+    #ifndef USE_FLOAT
+    __m512d acc0 = _mm512_setzero_pd();
+    __m512d acc1 = _mm512_setzero_pd();
+    for (; ix + 16 <= k; ix += 16) {
+        acc0 = _mm512_fmadd_pd(_mm512_loadu_pd(x + ix),     _mm512_loadu_pd(y + ix),     acc0);
+        acc1 = _mm512_fmadd_pd(_mm512_loadu_pd(x + ix + 8), _mm512_loadu_pd(y + ix + 8), acc1);
+    }
+    for (; ix + 8 <= k; ix += 8)
+        acc0 = _mm512_fmadd_pd(_mm512_loadu_pd(x + ix), _mm512_loadu_pd(y + ix), acc0);
+    real_t res = _mm512_reduce_add_pd(_mm512_add_pd(acc0, acc1));
+    #else
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    for (; ix + 32 <= k; ix += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + ix),      _mm512_loadu_ps(y + ix),      acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(x + ix + 16), _mm512_loadu_ps(y + ix + 16), acc1);
+    }
+    for (; ix + 16 <= k; ix += 16)
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + ix), _mm512_loadu_ps(y + ix), acc0);
+    real_t res = _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+    #endif
+    for (; ix < k; ix++)
+        res += x[ix] * y[ix];
+    return res;
+}
+
+__attribute__((target("avx512f")))
+static void taxpy_avx512(const real_t alpha, const real_t *restrict x, real_t *restrict y, const int k)
+{
+    int ix = 0;
+    #ifndef USE_FLOAT
+    __m512d valpha = _mm512_set1_pd(alpha);
+    for (; ix + 8 <= k; ix += 8)
+        _mm512_storeu_pd(y + ix,
+                         _mm512_fmadd_pd(valpha, _mm512_loadu_pd(x + ix),
+                                         _mm512_loadu_pd(y + ix)));
+    #else
+    __m512 valpha = _mm512_set1_ps(alpha);
+    for (; ix + 16 <= k; ix += 16)
+        _mm512_storeu_ps(y + ix,
+                         _mm512_fmadd_ps(valpha, _mm512_loadu_ps(x + ix),
+                                         _mm512_loadu_ps(y + ix)));
+    #endif
+    for (; ix < k; ix++)
+        y[ix] += alpha * x[ix];
+}
+
+#endif /* POISMF_X86_DISPATCH */
+
+/*  Batched natural log. Every non-zero in the objective evaluations pays
+    for one 'log()', and those calls are what the loops cannot vectorize
+    around: libm's log is scalar and its call breaks the surrounding SIMD.
+    The routine below is the standard argument-reduction + polynomial
+    scheme (same reduction and minimax coefficients as fdlibm's 'log'),
+    written branch-free over an array so the compiler can vectorize the
+    whole strip for the target's vector width. It only handles positive
+    normal finite inputs; the strip is scanned first and falls back to
+    libm element-wise when anything else shows up (zero predictions give
+    -inf upstream and that behavior is kept). Inputs are promoted to
+    double even in the float build, matching the plain 'log(pred)' calls
+    this replaces. */
+#define POISMF_DEFINE_VLOG(suffix, tattr) \
+tattr static void vlog_##suffix \
+(const real_t *restrict x, real_t *restrict out, const size_t n) \
+{ \
+    double lo = HUGE_VAL; \
+    double hi = 0; \
+    for (size_t i = 0; i < n; i++) { \
+        double xi = (double)x[i]; \
+        lo = (xi < lo)? xi : lo; \
+        hi = (xi > hi)? xi : hi; \
+    } \
+    if (!(lo >= 2.2250738585072014e-308 && hi <= 1.7976931348623157e308)) { \
+        for (size_t i = 0; i < n; i++) \
+            out[i] = log(x[i]); \
+        return; \
+    } \
+    for (size_t i = 0; i < n; i++) { \
+        union { double f; uint64_t u; } v; \
+        v.f = (double)x[i]; \
+        int e = (int)(v.u >> 52) - 1023; \
+        v.u = (v.u & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL; \
+        double m = v.f; \
+        int above_sqrt2 = m > 1.4142135623730951; \
+        e += above_sqrt2; \
+        m = above_sqrt2? 0.5*m : m; \
+        double f = m - 1.; \
+        double s = f / (2. + f); \
+        double z = s*s; \
+        double w = z*z; \
+        double t1 = w*(3.999999999940941908e-01 \
+                       + w*(2.222219843214978396e-01 \
+                            + w*1.531383769920937332e-01)); \
+        double t2 = z*(6.666666666666735130e-01 \
+                       + w*(2.857142874366239149e-01 \
+                            + w*(1.818357216161805012e-01 \
+                                 + w*1.479819860511658591e-01))); \
+        double hfsq = 0.5*f*f; \
+        out[i] = (real_t)((double)e*6.93147180369123816490e-01 \
+                          - ((hfsq - (s*(hfsq + (t1 + t2)) \
+                                      + (double)e*1.90821492927058770002e-10)) \
+                             - f)); \
+    } \
+}
+
+POISMF_DEFINE_VLOG(generic, )
+#ifdef POISMF_X86_DISPATCH
+POISMF_DEFINE_VLOG(avx2,   __attribute__((target("avx2,fma"))))
+POISMF_DEFINE_VLOG(avx512, __attribute__((target("avx512f"))))
+#endif
+
+/*  The fused loop bodies are stamped out once per instruction set through
+    this macro, so the 'dot' and 'axpy' above get inlined into functions
+    compiled with the matching target.
+
+    'X_map', when not NULL, gives the positions of this row's values inside
+    'Xr' (which then points at the full values array) instead of reading them
+    contiguously - this is how the column-sparse view can share storage with
+    the row-sparse values (see 'poismf_build_csc_map'). */
+#define X_VAL(ix) ((X_map == NULL)? Xr[ix] : Xr[X_map[ix]])
+#define POISMF_DEFINE_FUSED_KERNELS(suffix, tattr, dotfn, axpyfn) \
+tattr static real_t fused_fun_##suffix \
+( \
+    real_t *restrict a_row, real_t *restrict B, \
+    real_t *restrict Xr, sparse_ix *restrict X_ind, \
+    sparse_ix *restrict X_map, \
+    size_t nnz, int k \
+) \
+{ \
+    size_t k_szt = (size_t)k; \
+    real_t lsum = 0; \
+    real_t preds[POISMF_LOG_STRIP]; \
+    real_t logs[POISMF_LOG_STRIP]; \
+    for (size_t st = 0; st < nnz; st += POISMF_LOG_STRIP) { \
+        size_t n_strip = nnz - st; \
+        n_strip = (n_strip > POISMF_LOG_STRIP)? POISMF_LOG_STRIP : n_strip; \
+        for (size_t i = 0; i < n_strip; i++) \
+            preds[i] = dotfn(a_row, B + (size_t)X_ind[st + i]*k_szt, k); \
+        poismf_vlog(preds, logs, n_strip); \
+        for (size_t i = 0; i < n_strip; i++) \
+            lsum += X_VAL(st + i) * logs[i]; \
+    } \
+    return lsum; \
+} \
+tattr static void fused_grad_##suffix \
+( \
+    real_t *restrict a_row, real_t *restrict B, \
+    real_t *restrict Xr, sparse_ix *restrict X_ind, \
+    sparse_ix *restrict X_map, \
+    size_t nnz, int k, \
+    real_t mult, real_t *restrict grad \
+) \
+{ \
+    size_t k_szt = (size_t)k; \
+    real_t *restrict brow; \
+    for (size_t ix = 0; ix < nnz; ix++) { \
+        brow = B + (size_t)X_ind[ix]*k_szt; \
+        axpyfn(mult * X_VAL(ix) / dotfn(a_row, brow, k), brow, grad, k); \
+    } \
+} \
+tattr static real_t fused_fun_grad_##suffix \
+( \
+    real_t *restrict a_row, real_t *restrict B, \
+    real_t *restrict Xr, sparse_ix *restrict X_ind, \
+    sparse_ix *restrict X_map, \
+    size_t nnz, int k, \
+    real_t *restrict grad \
+) \
+{ \
+    size_t k_szt = (size_t)k; \
+    real_t *restrict brow; \
+    real_t lsum = 0; \
+    real_t preds[POISMF_LOG_STRIP]; \
+    real_t logs[POISMF_LOG_STRIP]; \
+    for (size_t st = 0; st < nnz; st += POISMF_LOG_STRIP) { \
+        size_t n_strip = nnz - st; \
+        n_strip = (n_strip > POISMF_LOG_STRIP)? POISMF_LOG_STRIP : n_strip; \
+        /* dot and axpy stay fused per non-zero (the B row is still hot); \
+           only the log is deferred to the batched pass over the strip */ \
+        for (size_t i = 0; i < n_strip; i++) { \
+            brow = B + (size_t)X_ind[st + i]*k_szt; \
+            preds[i] = dotfn(a_row, brow, k); \
+            axpyfn(- X_VAL(st + i) / preds[i], brow, grad, k); \
+        } \
+        poismf_vlog(preds, logs, n_strip); \
+        for (size_t i = 0; i < n_strip; i++) \
+            lsum += X_VAL(st + i) * logs[i]; \
+    } \
+    return lsum; \
+}
+
+POISMF_DEFINE_FUSED_KERNELS(generic, , tdot_generic, taxpy_generic)
+#ifdef POISMF_X86_DISPATCH
+POISMF_DEFINE_FUSED_KERNELS(avx2,   __attribute__((target("avx2,fma"))), tdot_avx2,   taxpy_avx2)
+POISMF_DEFINE_FUSED_KERNELS(avx512, __attribute__((target("avx512f"))),  tdot_avx512, taxpy_avx512)
+#endif
+
+/*  Fixed-width instantiations for the factor sizes used in practice. Fixing
+    'k' at compile time lets the compiler drop the loop-count bookkeeping,
+    fully unroll the dot/axpy bodies into a flat register block, and delete
+    the scalar tail (the widths here are multiples of every vector length).
+    Each wrapper pins the width and re-stamps the fused kernels through the
+    same macro, so there is exactly one body to maintain. */
+#define POISMF_DEFINE_FIXED_WIDTH(kval, tsuffix, tattr, dotfn, axpyfn) \
+tattr static real_t tdot_##tsuffix##_k##kval \
+(const real_t *restrict x, const real_t *restrict y, const int k) \
+{ \
+    (void)k; \
+    return dotfn(x, y, kval); \
+} \
+tattr static void taxpy_##tsuffix##_k##kval \
+(const real_t alpha, const real_t *restrict x, real_t *restrict y, const int k) \
+{ \
+    (void)k; \
+    axpyfn(alpha, x, y, kval); \
+} \
+POISMF_DEFINE_FUSED_KERNELS(tsuffix##_k##kval, tattr, \
+                            tdot_##tsuffix##_k##kval, taxpy_##tsuffix##_k##kval)
+
+POISMF_DEFINE_FIXED_WIDTH(32,  generic, , tdot_generic, taxpy_generic)
+POISMF_DEFINE_FIXED_WIDTH(64,  generic, , tdot_generic, taxpy_generic)
+POISMF_DEFINE_FIXED_WIDTH(128, generic, , tdot_generic, taxpy_generic)
+#ifdef POISMF_X86_DISPATCH
+POISMF_DEFINE_FIXED_WIDTH(32,  avx2,   __attribute__((target("avx2,fma"))), tdot_avx2,   taxpy_avx2)
+POISMF_DEFINE_FIXED_WIDTH(64,  avx2,   __attribute__((target("avx2,fma"))), tdot_avx2,   taxpy_avx2)
+POISMF_DEFINE_FIXED_WIDTH(128, avx2,   __attribute__((target("avx2,fma"))), tdot_avx2,   taxpy_avx2)
+POISMF_DEFINE_FIXED_WIDTH(32,  avx512, __attribute__((target("avx512f"))),  tdot_avx512, taxpy_avx512)
+POISMF_DEFINE_FIXED_WIDTH(64,  avx512, __attribute__((target("avx512f"))),  tdot_avx512, taxpy_avx512)
+POISMF_DEFINE_FIXED_WIDTH(128, avx512, __attribute__((target("avx512f"))),  tdot_avx512, taxpy_avx512)
+#endif
+
+/*  Kernels over the blocked-interleaved layout built by 'poismf_pack_B'
+    (see poismf.h for the layout itself). A flat B row spans k/8 cache
+    lines per double row and every non-zero fetches a different one, which
+    defeats the hardware prefetcher; in the packed form, all non-zeros of a
+    row whose indices fall in the same block of POISMF_PACK_WIDTH items are
+    served by one sequential sweep over that block's panel, with the dot
+    products computed vertically across the interleaved lanes. Block
+    occupancy is what makes this win, so it pays off most with indices
+    sorted within rows and item ids assigned by popularity (the usual
+    preprocessing for recommender data); unsorted input stays correct but
+    streams one panel per non-zero.
+
+    The bodies are plain C so the same macro can stamp them per instruction
+    set - with the lane count fixed at compile time, compilers vectorize
+    the lane loops to the width the target attribute allows. */
+#define POISMF_DEFINE_PACKED_KERNELS(suffix, tattr) \
+tattr static void pack_dots_##suffix \
+(const real_t *restrict panel, const real_t *restrict a_row, const int k, real_t *restrict dots) \
+{ \
+    for (int l = 0; l < POISMF_PACK_WIDTH; l++) \
+        dots[l] = 0; \
+    for (int j = 0; j < k; j++) { \
+        const real_t aj = a_row[j]; \
+        const real_t *restrict col = panel + (size_t)j*POISMF_PACK_WIDTH; \
+        for (int l = 0; l < POISMF_PACK_WIDTH; l++) \
+            dots[l] += aj * col[l]; \
+    } \
+} \
+tattr static void pack_axpy_##suffix \
+(const real_t *restrict panel, const real_t *restrict coefs, const int k, real_t *restrict grad) \
+{ \
+    for (int j = 0; j < k; j++) { \
+        const real_t *restrict col = panel + (size_t)j*POISMF_PACK_WIDTH; \
+        real_t acc = 0; \
+        for (int l = 0; l < POISMF_PACK_WIDTH; l++) \
+            acc += coefs[l] * col[l]; \
+        grad[j] += acc; \
+    } \
+} \
+tattr static real_t fused_fun_packed_##suffix \
+( \
+    real_t *restrict a_row, real_t *restrict B_pack, \
+    real_t *restrict Xr, sparse_ix *restrict X_ind, \
+    sparse_ix *restrict X_map, \
+    size_t nnz, int k \
+) \
+{ \
+    real_t dots[POISMF_PACK_WIDTH]; \
+    real_t preds[POISMF_LOG_STRIP]; \
+    real_t xvals[POISMF_LOG_STRIP]; \
+    real_t logs[POISMF_LOG_STRIP]; \
+    size_t n_strip = 0; \
+    real_t lsum = 0; \
+    size_t ix = 0; \
+    while (ix < nnz) { \
+        size_t g = (size_t)X_ind[ix] / POISMF_PACK_WIDTH; \
+        const real_t *restrict panel = B_pack + g*(size_t)POISMF_PACK_WIDTH*(size_t)k; \
+        pack_dots_##suffix(panel, a_row, k, dots); \
+        do { \
+            preds[n_strip] = dots[(size_t)X_ind[ix] - g*POISMF_PACK_WIDTH]; \
+            xvals[n_strip] = X_VAL(ix); \
+            if (++n_strip == POISMF_LOG_STRIP) { \
+                poismf_vlog(preds, logs, n_strip); \
+                for (size_t i = 0; i < n_strip; i++) \
+                    lsum += xvals[i] * logs[i]; \
+                n_strip = 0; \
+            } \
+            ix++; \
+        } while (ix < nnz && (size_t)X_ind[ix] / POISMF_PACK_WIDTH == g); \
+    } \
+    if (n_strip) poismf_vlog(preds, logs, n_strip); \
+    for (size_t i = 0; i < n_strip; i++) \
+        lsum += xvals[i] * logs[i]; \
+    return lsum; \
+} \
+tattr static void fused_grad_packed_##suffix \
+( \
+    real_t *restrict a_row, real_t *restrict B_pack, \
+    real_t *restrict Xr, sparse_ix *restrict X_ind, \
+    sparse_ix *restrict X_map, \
+    size_t nnz, int k, \
+    real_t mult, real_t *restrict grad \
+) \
+{ \
+    real_t dots[POISMF_PACK_WIDTH]; \
+    real_t coefs[POISMF_PACK_WIDTH]; \
+    size_t ix = 0; \
+    while (ix < nnz) { \
+        size_t g = (size_t)X_ind[ix] / POISMF_PACK_WIDTH; \
+        const real_t *restrict panel = B_pack + g*(size_t)POISMF_PACK_WIDTH*(size_t)k; \
+        pack_dots_##suffix(panel, a_row, k, dots); \
+        for (int l = 0; l < POISMF_PACK_WIDTH; l++) \
+            coefs[l] = 0; \
+        do { \
+            size_t lane = (size_t)X_ind[ix] - g*POISMF_PACK_WIDTH; \
+            coefs[lane] += mult * X_VAL(ix) / dots[lane]; \
+            ix++; \
+        } while (ix < nnz && (size_t)X_ind[ix] / POISMF_PACK_WIDTH == g); \
+        pack_axpy_##suffix(panel, coefs, k, grad); \
+    } \
+} \
+tattr static real_t fused_fun_grad_packed_##suffix \
+( \
+    real_t *restrict a_row, real_t *restrict B_pack, \
+    real_t *restrict Xr, sparse_ix *restrict X_ind, \
+    sparse_ix *restrict X_map, \
+    size_t nnz, int k, \
+    real_t *restrict grad \
+) \
+{ \
+    real_t dots[POISMF_PACK_WIDTH]; \
+    real_t coefs[POISMF_PACK_WIDTH]; \
+    real_t preds[POISMF_LOG_STRIP]; \
+    real_t xvals[POISMF_LOG_STRIP]; \
+    real_t logs[POISMF_LOG_STRIP]; \
+    size_t n_strip = 0; \
+    real_t lsum = 0; \
+    real_t xval; \
+    size_t ix = 0; \
+    while (ix < nnz) { \
+        size_t g = (size_t)X_ind[ix] / POISMF_PACK_WIDTH; \
+        const real_t *restrict panel = B_pack + g*(size_t)POISMF_PACK_WIDTH*(size_t)k; \
+        pack_dots_##suffix(panel, a_row, k, dots); \
+        for (int l = 0; l < POISMF_PACK_WIDTH; l++) \
+            coefs[l] = 0; \
+        do { \
+            size_t lane = (size_t)X_ind[ix] - g*POISMF_PACK_WIDTH; \
+            xval = X_VAL(ix); \
+            preds[n_strip] = dots[lane]; \
+            xvals[n_strip] = xval; \
+            if (++n_strip == POISMF_LOG_STRIP) { \
+                poismf_vlog(preds, logs, n_strip); \
+                for (size_t i = 0; i < n_strip; i++) \
+                    lsum += xvals[i] * logs[i]; \
+                n_strip = 0; \
+            } \
+            coefs[lane] -= xval / dots[lane]; \
+            ix++; \
+        } while (ix < nnz && (size_t)X_ind[ix] / POISMF_PACK_WIDTH == g); \
+        pack_axpy_##suffix(panel, coefs, k, grad); \
+    } \
+    if (n_strip) poismf_vlog(preds, logs, n_strip); \
+    for (size_t i = 0; i < n_strip; i++) \
+        lsum += xvals[i] * logs[i]; \
+    return lsum; \
+}
+
+POISMF_DEFINE_PACKED_KERNELS(generic, )
+#ifdef POISMF_X86_DISPATCH
+POISMF_DEFINE_PACKED_KERNELS(avx2,   __attribute__((target("avx2,fma"))))
+POISMF_DEFINE_PACKED_KERNELS(avx512, __attribute__((target("avx512f"))))
+#endif
+
+/* Runtime dispatch - resolved once on first use. If two threads race on the
+   initialization they will both write the same values, so no lock is needed. */
+typedef real_t fused_fun_fn(real_t *restrict a_row, real_t *restrict B,
+                            real_t *restrict Xr, sparse_ix *restrict X_ind,
+                            sparse_ix *restrict X_map,
+                            size_t nnz, int k);
+typedef void fused_grad_fn(real_t *restrict a_row, real_t *restrict B,
+                           real_t *restrict Xr, sparse_ix *restrict X_ind,
+                           sparse_ix *restrict X_map,
+                           size_t nnz, int k,
+                           real_t mult, real_t *restrict grad);
+typedef real_t fused_fun_grad_fn(real_t *restrict a_row, real_t *restrict B,
+                                 real_t *restrict Xr, sparse_ix *restrict X_ind,
+                                 sparse_ix *restrict X_map,
+                                 size_t nnz, int k,
+                                 real_t *restrict grad);
+
+static fused_fun_fn      *fused_fun_impl      = NULL;
+static fused_grad_fn     *fused_grad_impl     = NULL;
+static fused_fun_grad_fn *fused_fun_grad_impl = NULL;
+
+/* Same dispatch for the packed-layout kernels (B argument is the packed
+   buffer there, but the signatures line up) */
+static fused_fun_fn      *fused_fun_packed_impl      = NULL;
+static fused_grad_fn     *fused_grad_packed_impl     = NULL;
+static fused_fun_grad_fn *fused_fun_grad_packed_impl = NULL;
+
+typedef void vlog_fn(const real_t *restrict x, real_t *restrict out,
+                     const size_t n);
+static vlog_fn *vlog_impl = NULL;
+
+/* One extra slot per specialized width, same CPU selection as above.
+   Slot order matches 'fixed_k_slot'. */
+#define POISMF_N_FIXED_K 3
+static fused_fun_fn      *fused_fun_k_impl[POISMF_N_FIXED_K];
+static fused_grad_fn     *fused_grad_k_impl[POISMF_N_FIXED_K];
+static fused_fun_grad_fn *fused_fun_grad_k_impl[POISMF_N_FIXED_K];
+
+static int fixed_k_slot(const int k)
+{
+    switch (k) {
+        case 32:  return 0;
+        case 64:  return 1;
+        case 128: return 2;
+        default:  return -1;
+    }
+}
+
+#define POISMF_FILL_K_SLOTS(tsuffix) { \
+    fused_fun_k_impl[0]      = fused_fun_##tsuffix##_k32; \
+    fused_fun_k_impl[1]      = fused_fun_##tsuffix##_k64; \
+    fused_fun_k_impl[2]      = fused_fun_##tsuffix##_k128; \
+    fused_grad_k_impl[0]     = fused_grad_##tsuffix##_k32; \
+    fused_grad_k_impl[1]     = fused_grad_##tsuffix##_k64; \
+    fused_grad_k_impl[2]     = fused_grad_##tsuffix##_k128; \
+    fused_fun_grad_k_impl[0] = fused_fun_grad_##tsuffix##_k32; \
+    fused_fun_grad_k_impl[1] = fused_fun_grad_##tsuffix##_k64; \
+    fused_fun_grad_k_impl[2] = fused_fun_grad_##tsuffix##_k128; \
+}
+
+static void pick_fused_kernels(void)
+{
+    fused_fun_fn      *f_fun  = fused_fun_generic;
+    fused_grad_fn     *f_grad = fused_grad_generic;
+    fused_fun_grad_fn *f_both = fused_fun_grad_generic;
+    fused_fun_fn      *f_fun_p  = fused_fun_packed_generic;
+    fused_grad_fn     *f_grad_p = fused_grad_packed_generic;
+    fused_fun_grad_fn *f_both_p = fused_fun_grad_packed_generic;
+    vlog_fn           *f_vlog   = vlog_generic;
+    POISMF_FILL_K_SLOTS(generic)
+    #ifdef POISMF_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        f_fun  = fused_fun_avx2;
+        f_grad = fused_grad_avx2;
+        f_both = fused_fun_grad_avx2;
+        f_fun_p  = fused_fun_packed_avx2;
+        f_grad_p = fused_grad_packed_avx2;
+        f_both_p = fused_fun_grad_packed_avx2;
+        f_vlog   = vlog_avx2;
+        POISMF_FILL_K_SLOTS(avx2)
+    }
+    if (__builtin_cpu_supports("avx512f")) {
+        f_fun  = fused_fun_avx512;
+        f_grad = fused_grad_avx512;
+        f_both = fused_fun_grad_avx512;
+        f_fun_p  = fused_fun_packed_avx512;
+        f_grad_p = fused_grad_packed_avx512;
+        f_both_p = fused_fun_grad_packed_avx512;
+        f_vlog   = vlog_avx512;
+        POISMF_FILL_K_SLOTS(avx512)
+    }
+    #endif
+    fused_fun_impl      = f_fun;
+    fused_grad_impl     = f_grad;
+    fused_fun_grad_impl = f_both;
+    fused_fun_packed_impl      = f_fun_p;
+    fused_grad_packed_impl     = f_grad_p;
+    fused_fun_grad_packed_impl = f_both_p;
+    vlog_impl = f_vlog;
+}
+
+/*  Batched log over an arbitrary-length array (see the definition above
+    for accuracy and special-value handling). Defining POISMF_USE_MKL_VML
+    routes it through MKL's VML instead, for builds that already link MKL. */
+void poismf_vlog(const real_t *restrict x, real_t *restrict out, size_t n)
+{
+    #if defined(POISMF_USE_MKL_VML)
+    while (n > 0) {
+        MKL_INT n_this = (n > (size_t)INT_MAX)? (MKL_INT)INT_MAX : (MKL_INT)n;
+        #ifndef USE_FLOAT
+        vdLn(n_this, x, out);
+        #else
+        vsLn(n_this, x, out);
+        #endif
+        x += n_this;
+        out += n_this;
+        n -= (size_t)n_this;
+    }
+    #else
+    if (vlog_impl == NULL) pick_fused_kernels();
+    vlog_impl(x, out, n);
+    #endif
+}
+
+/* Returns sum(Xr[ix] * log(<a_row, B[X_ind[ix],:]>)) over the non-zeros */
+real_t fused_fun
+(
+    real_t *restrict a_row, real_t *restrict B,
+    real_t *restrict Xr, sparse_ix *restrict X_ind,
+    sparse_ix *restrict X_map,
+    size_t nnz, int k
+)
+{
+    if (fused_fun_impl == NULL) pick_fused_kernels();
+    int slot = fixed_k_slot(k);
+    if (slot >= 0)
+        return fused_fun_k_impl[slot](a_row, B, Xr, X_ind, X_map, nnz, k);
+    return fused_fun_impl(a_row, B, Xr, X_ind, X_map, nnz, k);
+}
+
+/* Accumulates mult * (Xr[ix] / <a_row, B[X_ind[ix],:]>) * B[X_ind[ix],:]
+   into 'grad' (which is not initialized here) over the non-zeros */
+void fused_grad
+(
+    real_t *restrict a_row, real_t *restrict B,
+    real_t *restrict Xr, sparse_ix *restrict X_ind,
+    sparse_ix *restrict X_map,
+    size_t nnz, int k,
+    real_t mult, real_t *restrict grad
+)
+{
+    if (fused_grad_impl == NULL) pick_fused_kernels();
+    int slot = fixed_k_slot(k);
+    if (slot >= 0)
+        fused_grad_k_impl[slot](a_row, B, Xr, X_ind, X_map, nnz, k, mult, grad);
+    else
+        fused_grad_impl(a_row, B, Xr, X_ind, X_map, nnz, k, mult, grad);
+}
+
+/* Does both of the above in a single pass over the non-zeros,
+   with the gradient multiplier fixed at -1 */
+real_t fused_fun_grad
+(
+    real_t *restrict a_row, real_t *restrict B,
+    real_t *restrict Xr, sparse_ix *restrict X_ind,
+    sparse_ix *restrict X_map,
+    size_t nnz, int k,
+    real_t *restrict grad
+)
+{
+    if (fused_fun_grad_impl == NULL) pick_fused_kernels();
+    int slot = fixed_k_slot(k);
+    if (slot >= 0)
+        return fused_fun_grad_k_impl[slot](a_row, B, Xr, X_ind, X_map, nnz, k, grad);
+    return fused_fun_grad_impl(a_row, B, Xr, X_ind, X_map, nnz, k, grad);
+}
+
+/* Builds the blocked-interleaved copy of B described in poismf.h. The
+   padding lanes of a partial last block are zeroed so the vertical dot
+   products over them are well-defined (their results are never read). */
+void poismf_pack_B(real_t *restrict B, size_t dimB, size_t k, real_t *restrict B_pack)
+{
+    if (dimB % POISMF_PACK_WIDTH) {
+        size_t last = (dimB / POISMF_PACK_WIDTH) * POISMF_PACK_WIDTH;
+        memset(B_pack + last*k, 0, POISMF_PACK_WIDTH*k*sizeof(real_t));
+    }
+    for (size_t row = 0; row < dimB; row++) {
+        const real_t *restrict src = B + row*k;
+        real_t *restrict dst = B_pack
+                                + (row / POISMF_PACK_WIDTH)*POISMF_PACK_WIDTH*k
+                                + (row % POISMF_PACK_WIDTH);
+        for (size_t j = 0; j < k; j++)
+            dst[j*POISMF_PACK_WIDTH] = src[j];
+    }
+}
+
+/* Counterparts of the three functions above reading the packed layout */
+real_t fused_fun_packed
+(
+    real_t *restrict a_row, real_t *restrict B_pack,
+    real_t *restrict Xr, sparse_ix *restrict X_ind,
+    sparse_ix *restrict X_map,
+    size_t nnz, int k
+)
+{
+    if (fused_fun_packed_impl == NULL) pick_fused_kernels();
+    return fused_fun_packed_impl(a_row, B_pack, Xr, X_ind, X_map, nnz, k);
+}
+
+void fused_grad_packed
+(
+    real_t *restrict a_row, real_t *restrict B_pack,
+    real_t *restrict Xr, sparse_ix *restrict X_ind,
+    sparse_ix *restrict X_map,
+    size_t nnz, int k,
+    real_t mult, real_t *restrict grad
+)
+{
+    if (fused_grad_packed_impl == NULL) pick_fused_kernels();
+    fused_grad_packed_impl(a_row, B_pack, Xr, X_ind, X_map, nnz, k, mult, grad);
+}
+
+real_t fused_fun_grad_packed
+(
+    real_t *restrict a_row, real_t *restrict B_pack,
+    real_t *restrict Xr, sparse_ix *restrict X_ind,
+    sparse_ix *restrict X_map,
+    size_t nnz, int k,
+    real_t *restrict grad
+)
+{
+    if (fused_fun_grad_packed_impl == NULL) pick_fused_kernels();
+    return fused_fun_grad_packed_impl(a_row, B_pack, Xr, X_ind, X_map, nnz, k, grad);
+}
@@ -107,6 +107,117 @@ int cmp_argsort(const void *a, const void *b)
     return (v1 == v2)? 0 : ((v1 < v2)? 1 : -1);
 }
 
+/*  Reentrant descending argsort (heapsort): same ordering as 'cmp_argsort'
+    but taking the score array as an argument instead of going through the
+    threadprivate pointer, so it can run on threads spawned inside a
+    parallel selection without any per-thread setup. Ties break by index so
+    the output is deterministic regardless of how the work was chunked. */
+#define ARGSORT_AFTER(a, b, values) \
+    ( (values)[a] < (values)[b] || ((values)[a] == (values)[b] && (a) > (b)) )
+
+static void argsort_desc_sift
+(
+    sparse_ix *restrict ix, real_t *restrict values,
+    size_t root, size_t end
+)
+{
+    sparse_ix temp;
+    for (;;)
+    {
+        size_t child = 2*root + 1;
+        if (child >= end) return;
+        if (child+1 < end && ARGSORT_AFTER(ix[child+1], ix[child], values))
+            child++;
+        if (ARGSORT_AFTER(ix[child], ix[root], values)) {
+            temp = ix[root]; ix[root] = ix[child]; ix[child] = temp;
+            root = child;
+        }
+        else return;
+    }
+}
+
+static void argsort_desc
+(
+    sparse_ix *restrict ix, real_t *restrict values, size_t n
+)
+{
+    sparse_ix temp;
+    if (n <= 1) return;
+    for (size_t st = n/2; st-- > 0; )
+        argsort_desc_sift(ix, values, st, n);
+    for (size_t end = n-1; end > 0; end--) {
+        temp = ix[0]; ix[0] = ix[end]; ix[end] = temp;
+        argsort_desc_sift(ix, values, 0, end);
+    }
+}
+
+/* Candidates per selection chunk below which threading the selection is
+   not worth the merge overhead */
+#define TOPN_SELECT_CHUNK_MIN ((size_t)65536)
+
+/*  Partial argsort of 'sel' (indices into 'scores') leaving the top 'n_top'
+    entries sorted by descending score at the front. Selection over millions
+    of candidates is a visible fraction of the request latency once the
+    scoring itself runs through BLAS, so for large inputs the array is split
+    into one chunk per thread, each chunk selects its local top-'n_top' in
+    parallel, and only the (n_chunks x n_top) survivors go through the final
+    quickselect and sort. Returns 0 on success, 1 on out-of-memory. */
+static int topN_select
+(
+    sparse_ix *restrict sel, real_t *restrict scores,
+    size_t n_take, size_t n_top, size_t n, int nthreads
+)
+{
+    /* If the number of elements is very small, it's faster to make a full
+       argsort, and if most of them are wanted a partial sort saves nothing */
+    if (n_take <= 50 || (real_t)n_take >= (real_t)n*0.75)
+    {
+        argsort_desc(sel, scores, n_take);
+        return 0;
+    }
+
+    size_t n_chunks = (nthreads > 1)? (size_t)nthreads : (size_t)1;
+    if (n_chunks > n_take / TOPN_SELECT_CHUNK_MIN)
+        n_chunks = n_take / TOPN_SELECT_CHUNK_MIN;
+    if (n_chunks > n_take / (4*n_top + 1))
+        n_chunks = n_take / (4*n_top + 1);
+
+    if (n_chunks >= 2)
+    {
+        #if defined(_OPENMP) && ((_OPENMP < 200801) || defined(_WIN32) || defined(_WIN64))
+        long long chunk = 0;
+        #else
+        size_t chunk = 0;
+        #endif
+        sparse_ix *restrict survivors = (sparse_ix*)
+            malloc(n_chunks*n_top*sizeof(sparse_ix));
+        if (survivors == NULL) return 1;
+
+        #pragma omp parallel for schedule(static) num_threads((int)n_chunks) \
+                shared(sel, scores, n_take, n_top, n_chunks, survivors)
+        for (chunk = 0; chunk < (sparse_ix)n_chunks; chunk++)
+        {
+            size_t st = (size_t)chunk * n_take / n_chunks;
+            size_t chunk_len = (size_t)(chunk+1) * n_take / n_chunks - st;
+            qs_argpartition(sel + st, scores, chunk_len, n_top);
+            memcpy(survivors + (size_t)chunk*n_top, sel + st,
+                   n_top*sizeof(sparse_ix));
+        }
+
+        qs_argpartition(survivors, scores, n_chunks*n_top, n_top);
+        argsort_desc(survivors, scores, n_top);
+        memcpy(sel, survivors, n_top*sizeof(sparse_ix));
+        free(survivors);
+    }
+
+    else
+    {
+        qs_argpartition(sel, scores, n_take, n_top);
+        argsort_desc(sel, scores, n_top);
+    }
+    return 0;
+}
+
 int topN
 (
     real_t *restrict a_vec, real_t *restrict B, int k,
@@ -222,44 +333,27 @@ int topN
     }
 
     /* If there is no real_t-mask for indices, do a partial argsort */
-    ptr_real_t_glob = buffer_scores;
     if (buffer_mask == NULL)
     {
-        /* If the number of elements is very small, it's faster to
-           make a full argsort, taking advantage of qsort's optimizations */
-        if (n_take <= 50 || n_take >= (real_t)n*0.75)
-        {
-            qsort(buffer_ix, n_take, sizeof(sparse_ix), cmp_argsort);
-        }
-
-        /* Otherwise, do a proper partial sort */
-        else
+        if (topN_select(buffer_ix, buffer_scores, n_take, n_top, n, nthreads))
         {
-            qs_argpartition(buffer_ix, buffer_scores, n_take, n_top);
-            qsort(buffer_ix, n_top, sizeof(sparse_ix), cmp_argsort);
+            retval = 1;
+            goto cleanup;
         }
-
         memcpy(outp_ix, buffer_ix, (size_t)n_top*sizeof(sparse_ix));
     }
 
     /* Otherwise, do a partial argsort with doubly-indexed arrays */
     else
     {
-        if (n_take <= 50 || n_take >= (real_t)n*0.75)
+        if (topN_select(buffer_mask, buffer_scores, n_take, n_top, n, nthreads))
         {
-            qsort(buffer_mask, n_take, sizeof(sparse_ix), cmp_argsort);
-        }
-
-        else
-        {
-            qs_argpartition(buffer_mask, buffer_scores, n_take, n_top);
-            qsort(buffer_mask, n_top, sizeof(sparse_ix), cmp_argsort);
+            retval = 1;
+            goto cleanup;
         }
-
         for (sparse_ix ix = 0; ix < (sparse_ix)n_top; ix++)
             outp_ix[ix] = buffer_ix[buffer_mask[ix]];
     }
-    ptr_real_t_glob = NULL;
 
     /* If scores were requested, need to also output those */
     if (outp_score != NULL)
@@ -279,4 +373,233 @@ int topN
         free(buffer_mask);
     if (retval == 1) return retval;
     return 0;
-} 
+}
+
+/*  Reusable exclusion sets for serving. 'topN' sorts the caller's exclusion
+    list and compacts the candidate array on every call, which is wasted
+    work when the same user's seen-items list is queried over and over. The
+    set is a plain bitset over the item ids, built once (typically from the
+    user's row of the training CSR) and consumed by 'topN_excl' with one
+    bit test per item and no sorting, compaction or index fill. */
+
+int poismf_exclude_set_init(poismf_exclude_set *restrict set, size_t n)
+{
+    set->n = n;
+    set->n_exclude = 0;
+    set->bits = (uint64_t*)calloc((n + 63) / 64, sizeof(uint64_t));
+    if (set->bits == NULL) {
+        fprintf(stderr, "Error: out of memory.\n");
+        return 1;
+    }
+    return 0;
+}
+
+void poismf_exclude_set_add(poismf_exclude_set *restrict set, sparse_ix ix)
+{
+    uint64_t *word = set->bits + ((size_t)ix >> 6);
+    uint64_t mask = (uint64_t)1 << ((size_t)ix & 63);
+    set->n_exclude += ((*word & mask) == 0);
+    *word |= mask;
+}
+
+/* Adds all of a user's items - e.g. from the training data:
+   poismf_exclude_set_from_row(set, Xr_indices + Xr_indptr[u],
+                               Xr_indptr[u+1] - Xr_indptr[u]) */
+void poismf_exclude_set_from_row
+(
+    poismf_exclude_set *restrict set,
+    sparse_ix X_ind[], size_t nnz
+)
+{
+    for (size_t ix = 0; ix < nnz; ix++)
+        poismf_exclude_set_add(set, X_ind[ix]);
+}
+
+void poismf_exclude_set_free(poismf_exclude_set *restrict set)
+{
+    free(set->bits);
+    memset(set, 0, sizeof(*set));
+}
+
+#define exclude_set_has(set, ix) \
+    (((set)->bits[(size_t)(ix) >> 6] >> ((size_t)(ix) & 63)) & 1)
+
+/*  Like 'topN' with an exclusion list, but consuming a prebuilt
+    'poismf_exclude_set' ('excl' may be NULL for none): scores everything
+    with one GEMV as the dense path does, then keeps a running top-N with a
+    single bit test per item - no sorting and no mutation of caller data.
+    Meant for the per-request serving path, where 'n_top' is small; the
+    running-minimum update makes the scan O(n) in practice.
+    Returns 0 on success, 1 on out-of-memory, 2 on invalid inputs. */
+int topN_excl
+(
+    real_t *restrict a_vec, real_t *restrict B, int k,
+    const poismf_exclude_set *restrict excl,
+    sparse_ix *restrict outp_ix, real_t *restrict outp_score,
+    size_t n_top, size_t n
+)
+{
+    if (n_top == 0 || n_top > n) return 2;
+    if (excl != NULL && (excl->n != n || excl->n_exclude > n - n_top))
+        return 2;
+
+    real_t *restrict buffer_scores = (real_t*)malloc(n*sizeof(real_t));
+    sparse_ix *restrict top_ix = (sparse_ix*)malloc(n_top*sizeof(sparse_ix));
+    real_t *restrict top_sc = (real_t*)malloc(n_top*sizeof(real_t));
+    sparse_ix *restrict out_order = (sparse_ix*)malloc(n_top*sizeof(sparse_ix));
+    int retval = 0;
+    size_t n_found = 0;
+    real_t min_sc = -HUGE_VAL;
+    size_t min_pos = 0;
+    if (buffer_scores == NULL || top_ix == NULL ||
+        top_sc == NULL || out_order == NULL)
+    {
+        retval = 1;
+        goto cleanup;
+    }
+
+    cblas_tgemv(CblasRowMajor, CblasNoTrans,
+                n, k,
+                1., B, k,
+                a_vec, 1,
+                0., buffer_scores, 1);
+
+    for (size_t ix = 0; ix < n; ix++)
+    {
+        if (excl != NULL && exclude_set_has(excl, ix)) continue;
+        if (n_found < n_top) {
+            top_ix[n_found] = (sparse_ix)ix;
+            top_sc[n_found] = buffer_scores[ix];
+            n_found++;
+            if (n_found == n_top) {
+                min_pos = 0;
+                for (size_t pos = 1; pos < n_top; pos++)
+                    if (top_sc[pos] < top_sc[min_pos]) min_pos = pos;
+                min_sc = top_sc[min_pos];
+            }
+        }
+        else if (buffer_scores[ix] > min_sc) {
+            top_ix[min_pos] = (sparse_ix)ix;
+            top_sc[min_pos] = buffer_scores[ix];
+            min_pos = 0;
+            for (size_t pos = 1; pos < n_top; pos++)
+                if (top_sc[pos] < top_sc[min_pos]) min_pos = pos;
+            min_sc = top_sc[min_pos];
+        }
+    }
+
+    for (size_t pos = 0; pos < n_found; pos++)
+        out_order[pos] = (sparse_ix)pos;
+    argsort_desc(out_order, top_sc, n_found);
+    for (size_t pos = 0; pos < n_found; pos++)
+    {
+        outp_ix[pos] = top_ix[out_order[pos]];
+        if (outp_score != NULL)
+            outp_score[pos] = top_sc[out_order[pos]];
+    }
+
+    cleanup:
+        free(buffer_scores);
+        free(top_ix);
+        free(top_sc);
+        free(out_order);
+    return retval;
+}
+
+/* Block of rows of A taken per GEMM call, and target size (in bytes) for the
+   panels of B, chosen so that a panel stays in cache while it is re-used
+   by every row of the user block */
+#define TOPN_USERS_BLOCK 32
+#define TOPN_PANEL_BYTES ((size_t)1 << 20)
+
+/*  Batched version of 'topN' for ranking many users in one go.
+
+    Calling 'topN' once per user re-reads the whole B matrix from main memory
+    for every call (a GEMV is memory-bound). This function instead scores a
+    block of user rows at a time against cache-sized panels of B through GEMM,
+    and runs the partial argsort for each row while its score block is still
+    hot, so B is streamed from memory only once per TOPN_USERS_BLOCK users.
+
+    'outp_ix' and 'outp_score' must have dimension [dimA, n_top] in row-major
+    order ('outp_score' may be NULL). Unlike 'topN', there are no per-user
+    include/exclude lists here - for filtered rankings, use 'topN' on the
+    individual rows. */
+int topN_multiple
+(
+    real_t *restrict A, size_t dimA, real_t *restrict B, int k,
+    sparse_ix *restrict outp_ix, real_t *restrict outp_score,
+    size_t n_top, size_t n, int nthreads
+)
+{
+    if (n_top == 0 || n_top > n) return 2;
+    if (dimA == 0) return 0;
+
+    #if defined(_OPENMP) && ((_OPENMP < 200801) || defined(_WIN32) || defined(_WIN64))
+    long long row = 0;
+    #else
+    size_t row = 0;
+    #endif
+
+    int retval = 0;
+    size_t k_szt = (size_t) k;
+    size_t users_block = (dimA < (size_t)TOPN_USERS_BLOCK)?
+                          dimA : (size_t)TOPN_USERS_BLOCK;
+    size_t items_tile = TOPN_PANEL_BYTES / (k_szt * sizeof(real_t));
+    if (items_tile < 256) items_tile = 256;
+    if (items_tile > n) items_tile = n;
+
+    real_t *restrict buffer_scores = (real_t*)malloc(users_block * n * sizeof(real_t));
+    sparse_ix *restrict buffer_ix = (sparse_ix*)malloc((size_t)nthreads * n * sizeof(sparse_ix));
+    if (buffer_scores == NULL || buffer_ix == NULL) { retval = 1; goto cleanup; }
+
+    for (size_t ia = 0; ia < dimA; ia += users_block)
+    {
+        size_t bu = ((dimA - ia) < users_block)? (dimA - ia) : users_block;
+
+        for (size_t it = 0; it < n; it += items_tile)
+        {
+            size_t bi = ((n - it) < items_tile)? (n - it) : items_tile;
+            cblas_tgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
+                        (int)bu, (int)bi, k,
+                        1., A + ia*k_szt, k,
+                        B + it*k_szt, k,
+                        0., buffer_scores + it, (int)n);
+        }
+
+        /* Rank each row of the score block while it is still in cache */
+        #pragma omp parallel for schedule(dynamic, 1) num_threads(nthreads) \
+                shared(bu, ia, n, n_top, k, buffer_scores, buffer_ix, outp_ix, outp_score)
+        for (row = 0; row < (sparse_ix)bu; row++)
+        {
+            real_t *restrict scores = buffer_scores + (size_t)row * n;
+            sparse_ix *restrict argsorted = buffer_ix + (size_t)omp_get_thread_num() * n;
+            for (sparse_ix ix = 0; ix < (sparse_ix)n; ix++)
+                argsorted[ix] = ix;
+
+            ptr_real_t_glob = scores;
+            if (n <= 50 || (real_t)n_top >= (real_t)n*0.75)
+            {
+                qsort(argsorted, n, sizeof(sparse_ix), cmp_argsort);
+            }
+
+            else
+            {
+                qs_argpartition(argsorted, scores, n, n_top);
+                qsort(argsorted, n_top, sizeof(sparse_ix), cmp_argsort);
+            }
+            ptr_real_t_glob = NULL;
+
+            memcpy(outp_ix + (ia + (size_t)row)*n_top, argsorted,
+                   n_top*sizeof(sparse_ix));
+            if (outp_score != NULL)
+                for (sparse_ix ix = 0; ix < (sparse_ix)n_top; ix++)
+                    outp_score[(ia + (size_t)row)*n_top + ix] = scores[argsorted[ix]];
+        }
+    }
+
+    cleanup:
+        free(buffer_scores);
+        free(buffer_ix);
+    if (retval == 1) return retval;
+    return 0;
+}